@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+// O_DIRECT transfers bypass the page cache, so the buffer address, the file
+// offset and the length must all be multiples of the device's logical block
+// size. 4 KiB covers every common device.
+inline constexpr std::size_t direct_alignment = 4096;
+
+inline constexpr std::size_t align_up(std::size_t n, std::size_t alignment = direct_alignment) {
+    return (n + alignment - 1) / alignment * alignment;
+}
+
+// Fixed-size buffers carved from one mapping, each aligned for O_DIRECT.
+//
+// A pool of 2 MiB or more first asks for explicit huge pages (MAP_HUGETLB,
+// which needs pages reserved in /proc/sys/vm/nr_hugepages); without them it
+// takes normal pages and advises transparent huge pages (MADV_HUGEPAGE).
+// Huge pages mean far fewer TLB misses while streaming through the buffers,
+// and fewer pages for the kernel to pin when a buffer is registered with
+// io_uring or used for O_DIRECT.
+class AlignedBufferPool {
+public:
+    static constexpr std::size_t huge_page_size = 2 * 1024 * 1024;
+
+    // `count` buffers of `buffer_size` bytes, rounded up to the alignment
+    AlignedBufferPool(std::size_t buffer_size, std::size_t count)
+        : buffer_size_(align_up(buffer_size)), count_(count) {
+        std::size_t size = buffer_size_ * count_;
+        if (size >= huge_page_size) {
+            mapped_ = align_up(size, huge_page_size);
+            void* data = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (data != MAP_FAILED) {
+                data_ = static_cast<char*>(data);
+                huge_pages_ = true;
+            }
+        }
+        if (!data_) {
+            mapped_ = align_up(std::max<std::size_t>(size, 1));
+            void* data = ::mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data == MAP_FAILED) throw std::bad_alloc();
+            data_ = static_cast<char*>(data);
+            if (size >= huge_page_size) ::madvise(data_, mapped_, MADV_HUGEPAGE);
+        }
+        free_.reserve(count_);
+        for (std::size_t i = count_; i-- > 0;) free_.push_back(data_ + i * buffer_size_);
+    }
+
+    AlignedBufferPool(const AlignedBufferPool&) = delete;
+    AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+
+    ~AlignedBufferPool() { ::munmap(data_, mapped_); }
+
+    std::size_t buffer_size() const { return buffer_size_; }
+    std::size_t count() const { return count_; }
+    bool huge_pages() const { return huge_pages_; } // Explicit huge pages rather than (maybe) transparent ones
+
+    // The i-th buffer, for callers that index the buffers themselves
+    char* buffer(std::size_t i) const { return data_ + i * buffer_size_; }
+
+    // A free buffer, or nullptr if all are in use
+    char* acquire() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (free_.empty()) return nullptr;
+        char* buffer = free_.back();
+        free_.pop_back();
+        return buffer;
+    }
+
+    void release(char* buffer) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(buffer);
+    }
+
+private:
+    std::size_t buffer_size_;
+    std::size_t count_;
+    std::size_t mapped_ = 0;
+    char* data_ = nullptr;
+    bool huge_pages_ = false;
+    std::mutex mutex_; // Guards free_
+    std::vector<char*> free_;
+};
+
+// open() with O_DIRECT when `direct` is set. Filesystems without direct I/O
+// (tmpfs, some FUSE and network filesystems) reject it with EINVAL; the file
+// is then opened through the page cache and `direct` cleared.
+inline int open_direct(const char* path, int flags, mode_t mode, bool& direct) {
+    if (direct) {
+        int fd = ::open(path, flags | O_DIRECT, mode);
+        if (fd >= 0 || errno != EINVAL) return fd;
+        direct = false;
+    }
+    return ::open(path, flags, mode);
+}
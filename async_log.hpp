@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include <unistd.h>
+
+#include "spsc_queue.hpp"
+
+// Asynchronous logging for the demos' hot paths:
+//
+//   alog::info("Received: ", std::string_view(data, length));
+//
+// The calling thread only copies its raw arguments into a fixed-size record
+// on its own SPSCQueue (no lock, no allocation, no formatting). A background
+// writer thread drains every thread's queue, formats the records and hands
+// each batch to the kernel with a single write().
+//
+// Calls below ALOG_LEVEL (0 debug, 1 info, 2 warn, 3 error; default 1) are
+// compiled out. Their arguments are still evaluated, so pass raw values
+// rather than building strings.
+//
+// A full queue drops the record instead of blocking the caller; the writer
+// reports how many were dropped. Arguments may be arithmetic values or
+// anything convertible to std::string_view, which is copied (and truncated
+// to what fits in the record).
+#ifndef ALOG_LEVEL
+#define ALOG_LEVEL 1
+#endif
+
+namespace alog {
+
+enum class Level { debug, info, warn, error };
+
+inline constexpr Level compiled_level = static_cast<Level>(ALOG_LEVEL);
+
+class Logger {
+public:
+    static constexpr std::size_t record_size = 256; // Bytes per record, arguments included
+    static constexpr std::size_t queue_capacity = 1024; // Records per thread
+
+    static Logger& instance() {
+        static Logger logger;
+        return logger;
+    }
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    // Writes out everything still queued, then stops the writer
+    ~Logger() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        writer_wake_.notify_all();
+        writer_.join();
+    }
+
+    // File descriptor the writer writes to (standard output by default)
+    void set_fd(int fd) { fd_.store(fd, std::memory_order_relaxed); }
+
+    template<class... Args>
+    void write(Level level, const Args&... args) {
+        static_assert(fixed_size<Args...>() <= payload_size, "Too many arguments for one log record");
+        Producer& producer = local_producer();
+        void* slot = producer.queue.reserve();
+        if (!slot) {
+            producer.dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        Record* record = new (slot) Record;
+        record->format = &format_record<stored_t<Args>...>;
+        record->level = level;
+        unsigned char* in = record->args;
+        unsigned char* end = record->args + payload_size;
+        std::size_t fixed_left = fixed_size<Args...>();
+        std::size_t strings_left = string_count<Args...>();
+        ((in = encode(in, end, fixed_left, strings_left, static_cast<const stored_t<Args>&>(args))), ...);
+        producer.queue.commit();
+    }
+
+    // Block until everything this thread logged before the call is written
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::uint64_t ticket = ++flush_requested_;
+        writer_wake_.notify_all();
+        flushed_wake_.wait(lock, [&] { return flushed_ >= ticket; });
+    }
+
+private:
+    static constexpr std::size_t max_line = 4096; // Longest formatted record
+    static constexpr std::size_t buffer_size = 64 * 1024; // Bytes formatted per write()
+    static constexpr auto poll_interval = std::chrono::milliseconds(1); // Writer's sleep when all queues are empty
+    static constexpr auto max_poll_interval = std::chrono::milliseconds(32); // ... doubling up to this while they stay empty
+
+    struct Record;
+    using Formatter = char* (*)(const unsigned char* args, char* out, char* end);
+
+    struct RecordHeader {
+        Formatter format;
+        Level level;
+    };
+
+    static constexpr std::size_t payload_size = record_size - sizeof(RecordHeader);
+
+    struct Record : RecordHeader {
+        unsigned char args[payload_size];
+    };
+
+    struct Producer {
+        SPSCQueue<Record, queue_capacity> queue;
+        std::atomic<std::size_t> dropped{0};
+        std::atomic<bool> retired{false}; // Its thread has exited
+    };
+
+    // Registers the thread's queue on first use and retires it when the thread exits
+    struct ProducerHandle {
+        explicit ProducerHandle(Logger& logger) : producer(std::make_shared<Producer>()) {
+            std::lock_guard<std::mutex> lock(logger.mutex_);
+            logger.registered_.push_back(producer);
+            ++logger.registry_version_;
+        }
+        ~ProducerHandle() { producer->retired.store(true, std::memory_order_release); }
+
+        std::shared_ptr<Producer> producer;
+    };
+
+    Logger() : writer_([this] { run(); }) {}
+
+    Producer& local_producer() {
+        thread_local ProducerHandle handle(*this);
+        return *handle.producer;
+    }
+
+    // Strings are stored as their bytes; everything else as itself
+    template<class T>
+    using stored_t = std::conditional_t<std::is_convertible_v<const T&, std::string_view>, std::string_view, T>;
+
+    template<class... Args>
+    static constexpr std::size_t string_count() {
+        return (std::size_t(0) + ... + (std::is_same_v<stored_t<Args>, std::string_view> ? 1 : 0));
+    }
+
+    // Bytes the arguments need before any string contents: values, and a length per string
+    template<class... Args>
+    static constexpr std::size_t fixed_size() {
+        return (std::size_t(0) + ... +
+                (std::is_same_v<stored_t<Args>, std::string_view> ? sizeof(std::uint16_t) : sizeof(stored_t<Args>)));
+    }
+
+    // fixed_left: bytes still owed to the later arguments (see fixed_size());
+    // strings_left: strings not yet encoded, this one included
+    template<class T>
+    static unsigned char* encode(unsigned char* in, unsigned char*, std::size_t& fixed_left, std::size_t&, const T& value) {
+        static_assert(std::is_arithmetic_v<T>, "Log arguments must be arithmetic or string-like");
+        fixed_left -= sizeof(T);
+        std::memcpy(in, &value, sizeof(T));
+        return in + sizeof(T);
+    }
+
+    // A string gets an equal share of the space the later arguments leave over
+    static unsigned char* encode(unsigned char* in, unsigned char* end, std::size_t& fixed_left, std::size_t& strings_left,
+                                 std::string_view value) {
+        fixed_left -= sizeof(std::uint16_t);
+        std::size_t room = static_cast<std::size_t>(end - in) - sizeof(std::uint16_t) - fixed_left;
+        auto length = static_cast<std::uint16_t>(std::min(value.size(), room / strings_left));
+        --strings_left;
+        std::memcpy(in, &length, sizeof(length));
+        std::memcpy(in + sizeof(length), value.data(), length);
+        return in + sizeof(length) + length;
+    }
+
+    template<class T>
+    static char* format_value(const unsigned char*& args, char* out, char* end) {
+        if constexpr (std::is_same_v<T, std::string_view>) {
+            std::uint16_t length;
+            std::memcpy(&length, args, sizeof(length));
+            std::size_t n = std::min<std::size_t>(length, static_cast<std::size_t>(end - out));
+            std::memcpy(out, args + sizeof(length), n);
+            args += sizeof(length) + length;
+            return out + n;
+        } else {
+            T value;
+            std::memcpy(&value, args, sizeof(T));
+            args += sizeof(T);
+            if constexpr (std::is_same_v<T, bool>) {
+                std::string_view text = value ? "true" : "false";
+                std::size_t n = std::min<std::size_t>(text.size(), static_cast<std::size_t>(end - out));
+                std::memcpy(out, text.data(), n);
+                return out + n;
+            } else if constexpr (std::is_same_v<T, char>) {
+                if (out != end) *out++ = value;
+                return out;
+            } else {
+                auto [ptr, ec] = std::to_chars(out, end, value);
+                return ec == std::errc() ? ptr : out;
+            }
+        }
+    }
+
+    // Runs on the writer thread: the deferred formatting of one record
+    template<class... Stored>
+    static char* format_record(const unsigned char* args, char* out, char* end) {
+        ((out = format_value<Stored>(args, out, end)), ...);
+        return out;
+    }
+
+    static char* append(char* out, std::string_view text) {
+        std::memcpy(out, text.data(), text.size());
+        return out + text.size();
+    }
+
+    void run() {
+        std::vector<char> buffer(buffer_size);
+        std::vector<std::shared_ptr<Producer>> producers;
+        std::uint64_t seen_version = 0;
+        std::chrono::milliseconds idle_sleep = poll_interval;
+        for (;;) {
+            std::uint64_t requested;
+            bool stopping;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                requested = flush_requested_;
+                stopping = stopping_;
+                if (registry_version_ != seen_version) { // New threads, or retired ones to forget
+                    seen_version = registry_version_;
+                    registered_.erase(std::remove_if(registered_.begin(), registered_.end(),
+                        [](const auto& p) {
+                            return p->retired.load(std::memory_order_acquire) && p->queue.empty() &&
+                                   p->dropped.load(std::memory_order_relaxed) == 0; // Its drop count not yet reported
+                        }),
+                        registered_.end());
+                    producers = registered_;
+                }
+            }
+
+            bool wrote = drain(producers, buffer);
+            bool retired = std::any_of(producers.begin(), producers.end(),
+                [](const auto& p) { return p->retired.load(std::memory_order_acquire); });
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (retired) ++registry_version_; // Drop them on the next pass
+            if (flushed_ != requested) {
+                flushed_ = requested;
+                flushed_wake_.notify_all();
+            }
+            if (stopping && !wrote) return;
+            if (wrote) {
+                idle_sleep = poll_interval;
+            } else { // Back off while idle; flush() and stopping wake the writer at once
+                writer_wake_.wait_for(lock, idle_sleep, [&] { return stopping_ || flush_requested_ != flushed_; });
+                idle_sleep = std::min<std::chrono::milliseconds>(idle_sleep * 2, max_poll_interval);
+            }
+        }
+    }
+
+    // Format every queued record into `buffer`, writing it out whenever it
+    // fills up and once at the end; true if anything was written
+    bool drain(const std::vector<std::shared_ptr<Producer>>& producers, std::vector<char>& buffer) {
+        char* const begin = buffer.data();
+        char* out = begin;
+        bool wrote = false;
+        auto make_room = [&] {
+            if (static_cast<std::size_t>(buffer.data() + buffer.size() - out) >= max_line) return;
+            write_all(begin, out);
+            out = begin;
+            wrote = true;
+        };
+        for (const auto& producer : producers) {
+            while (Record* record = producer->queue.peek()) {
+                make_room();
+                char* line = out;
+                if (record->level == Level::warn) out = append(out, "warning: ");
+                if (record->level == Level::error) out = append(out, "error: ");
+                out = record->format(record->args, out, line + max_line - 1);
+                *out++ = '\n';
+                producer->queue.release();
+            }
+            if (std::size_t dropped = producer->dropped.exchange(0, std::memory_order_relaxed)) {
+                make_room();
+                out = append(out, "warning: ");
+                out = std::to_chars(out, out + 32, dropped).ptr;
+                out = append(out, " log records dropped (queue full)\n");
+            }
+        }
+        if (out != begin) {
+            write_all(begin, out);
+            wrote = true;
+        }
+        return wrote;
+    }
+
+    void write_all(const char* begin, const char* end) {
+        int fd = fd_.load(std::memory_order_relaxed);
+        while (begin < end) {
+            ssize_t n = ::write(fd, begin, static_cast<std::size_t>(end - begin));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return; // Nowhere to log to
+            begin += n;
+        }
+    }
+
+    std::mutex mutex_; // Guards everything below except fd_
+    std::vector<std::shared_ptr<Producer>> registered_;
+    std::uint64_t registry_version_ = 0;
+    std::uint64_t flush_requested_ = 0;
+    std::uint64_t flushed_ = 0;
+    bool stopping_ = false;
+    std::condition_variable writer_wake_;
+    std::condition_variable flushed_wake_;
+    std::atomic<int> fd_{STDOUT_FILENO};
+    std::thread writer_; // Last: starts once everything above is constructed
+};
+
+template<Level L, class... Args>
+void log(const Args&... args) {
+    if constexpr (L >= compiled_level) Logger::instance().write(L, args...);
+}
+
+template<class... Args> void debug(const Args&... args) { log<Level::debug>(args...); }
+template<class... Args> void info(const Args&... args) { log<Level::info>(args...); }
+template<class... Args> void warn(const Args&... args) { log<Level::warn>(args...); }
+template<class... Args> void error(const Args&... args) { log<Level::error>(args...); }
+
+// Block until everything the calling thread logged so far is written
+inline void flush() { Logger::instance().flush(); }
+
+}  // namespace alog
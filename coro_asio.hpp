@@ -0,0 +1,110 @@
+#pragma once
+
+#include <coroutine>
+#include <optional>
+#include <tuple>
+#include <utility>  // Before Asio: boost/asio/awaitable.hpp (1.74) uses std::exchange without it
+
+#include <boost/asio.hpp>
+
+#include "coro_task.hpp"
+
+// Boost.Asio completion token for coro::task coroutines:
+//
+//   auto [ec, n] = co_await socket.async_read_some(buffer, coro::use_task);
+//   boost::system::error_code ec = co_await timer.async_wait(coro::use_task);
+//
+// The operation is started when the coroutine suspends and its completion
+// handler resumes the coroutine directly. The handler holds only a pointer to
+// the awaiter (which lives in the coroutine frame), so there is no
+// shared_from_this() refcount traffic per I/O step.
+namespace coro {
+
+struct use_task_t {};
+inline constexpr use_task_t use_task{};
+
+// Asio allocates the state of every pending operation through the completion
+// handler's associated allocator. Handlers created by use_task hand out this
+// one, which draws from the same thread-local recycling pool as coroutine
+// frames, so a steady stream of reads and writes stops calling malloc.
+template<class T>
+struct HandlerAllocator {
+    using value_type = T;
+
+    HandlerAllocator() noexcept = default;
+    template<class U>
+    HandlerAllocator(const HandlerAllocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) { return static_cast<T*>(FrameAllocator::allocate(n * sizeof(T))); }
+    void deallocate(T* p, std::size_t n) noexcept { FrameAllocator::deallocate(p, n * sizeof(T)); }
+
+    template<class U>
+    bool operator==(const HandlerAllocator<U>&) const noexcept { return true; }
+    template<class U>
+    bool operator!=(const HandlerAllocator<U>&) const noexcept { return false; }
+};
+
+namespace detail {
+
+template<class Initiation, class ArgsTuple, class... Results>
+class asio_operation {
+public:
+    asio_operation(Initiation initiation, ArgsTuple args)
+        : initiation_(std::move(initiation)), args_(std::move(args)) {}
+
+    bool await_ready() noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        handle_ = handle;
+        std::apply([this](auto&&... args) {
+            std::move(initiation_)(handler{this}, std::move(args)...);
+        }, std::move(args_));
+    }
+
+    // error_code alone, or a tuple of the error_code and the other results
+    auto await_resume() {
+        if constexpr (sizeof...(Results) == 0) {
+            return std::get<0>(std::move(*results_));
+        } else {
+            return std::move(*results_);
+        }
+    }
+
+private:
+    struct handler {
+        using allocator_type = HandlerAllocator<void>;
+
+        asio_operation* op;
+
+        allocator_type get_allocator() const noexcept { return {}; }
+
+        void operator()(boost::system::error_code ec, Results... results) {
+            op->results_.emplace(ec, std::move(results)...);
+            op->handle_.resume();
+        }
+    };
+
+    Initiation initiation_;
+    ArgsTuple args_;
+    std::coroutine_handle<> handle_;
+    std::optional<std::tuple<boost::system::error_code, Results...>> results_;
+};
+
+}  // namespace detail
+}  // namespace coro
+
+namespace boost {
+namespace asio {
+
+template<class... Results>
+class async_result<coro::use_task_t, void(boost::system::error_code, Results...)> {
+public:
+    template<class Initiation, class... Args>
+    static auto initiate(Initiation initiation, coro::use_task_t, Args... args) {
+        return coro::detail::asio_operation<Initiation, std::tuple<Args...>, std::decay_t<Results>...>(
+            std::move(initiation), std::make_tuple(std::move(args)...));
+    }
+};
+
+}  // namespace asio
+}  // namespace boost
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+// Minimal C++20 coroutine support shared by the demos:
+//   coro::task<T>         lazy coroutine; awaiting it starts it (symmetric transfer)
+//   coro::spawn(task)     start a task<void> without waiting for it
+//   coro::sync_wait(task) start a task and block the calling thread for its result
+//   coro::schedule_on(x)  resume the awaiting coroutine on executor x
+// Coroutine frames are allocated through coro::FrameAllocator.
+namespace coro {
+
+// Thread-local recycling allocator for coroutine frames. Frames are rounded up
+// to a size class and returned to the freeing thread's cache instead of the
+// heap, so a steady stream of same-shaped coroutines stops calling malloc.
+class FrameAllocator {
+public:
+    static void* allocate(std::size_t size) {
+        std::size_t index = class_index(size);
+        if (index < class_count && recycling.load(std::memory_order_relaxed)) {
+            Cache& cache = local_cache();
+            if (FreeFrame* frame = cache.free_lists[index]) {
+                cache.free_lists[index] = frame->next;
+                --cache.counts[index];
+                recycled.fetch_add(1, std::memory_order_relaxed);
+                return frame;
+            }
+        }
+        heap_allocations.fetch_add(1, std::memory_order_relaxed);
+        return ::operator new(index < class_count ? class_size(index) : size);
+    }
+
+    static void deallocate(void* p, std::size_t size) {
+        std::size_t index = class_index(size);
+        if (index < class_count && recycling.load(std::memory_order_relaxed)) {
+            Cache& cache = local_cache();
+            if (cache.counts[index] < max_cached) {
+                FreeFrame* frame = static_cast<FreeFrame*>(p);
+                frame->next = cache.free_lists[index];
+                cache.free_lists[index] = frame;
+                ++cache.counts[index];
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+    static inline std::atomic<bool> recycling{true};  // Off: every frame goes to the heap
+    static inline std::atomic<std::size_t> heap_allocations{0};  // Frames that came from the heap
+    static inline std::atomic<std::size_t> recycled{0};  // Frames served from a cache
+
+private:
+    static constexpr std::size_t class_count = 64;  // 64-byte steps up to 4 KiB
+    static constexpr std::size_t max_cached = 64;  // Per size class and thread
+
+    struct FreeFrame { FreeFrame* next; };
+
+    struct Cache {
+        FreeFrame* free_lists[class_count] = {};
+        std::size_t counts[class_count] = {};
+
+        ~Cache() {
+            for (FreeFrame* head : free_lists) {
+                while (head) {
+                    FreeFrame* next = head->next;
+                    ::operator delete(head);
+                    head = next;
+                }
+            }
+        }
+    };
+
+    static std::size_t class_index(std::size_t size) { return (size + 63) / 64 - 1; }
+    static std::size_t class_size(std::size_t index) { return (index + 1) * 64; }
+
+    static Cache& local_cache() {
+        thread_local Cache cache;
+        return cache;
+    }
+};
+
+template<class T = void> class task;
+
+namespace detail {
+
+// Parts of the promise shared by every task<T>
+struct promise_base {
+    // Resumed when this task finishes; nothing to resume for a spawned task
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        template<class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> self) noexcept {
+            return self.promise().continuation;  // Symmetric transfer: no stack growth
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+
+    static void* operator new(std::size_t size) { return FrameAllocator::allocate(size); }
+    static void operator delete(void* p, std::size_t size) { FrameAllocator::deallocate(p, size); }
+};
+
+template<class T>
+struct task_promise : promise_base {
+    task<T> get_return_object();
+
+    template<class U>
+    void return_value(U&& value) { result.emplace(std::forward<U>(value)); }
+
+    T take() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*result);
+    }
+
+    std::optional<T> result;
+};
+
+template<>
+struct task_promise<void> : promise_base {
+    task<void> get_return_object();
+
+    void return_void() {}
+
+    void take() {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+// Fire-and-forget coroutine: starts eagerly and frees its own frame at the end
+struct detached {
+    struct promise_type {
+        detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+
+        static void* operator new(std::size_t size) { return FrameAllocator::allocate(size); }
+        static void operator delete(void* p, std::size_t size) { FrameAllocator::deallocate(p, size); }
+    };
+};
+
+}  // namespace detail
+
+// Lazily-started coroutine producing a T. Owns its frame; move-only.
+template<class T>
+class task {
+public:
+    using promise_type = detail::task_promise<T>;
+
+    task() noexcept = default;
+    explicit task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+    task(task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task() {
+        if (handle_) handle_.destroy();
+    }
+
+    // Awaiting a task starts it and resumes the awaiter when it finishes
+    auto operator co_await() noexcept {
+        struct awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return !handle || handle.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() { return handle.promise().take(); }
+        };
+        return awaiter{handle_};
+    }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template<class T>
+task<T> task_promise<T>::get_return_object() {
+    return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+
+inline task<void> task_promise<void>::get_return_object() {
+    return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+}  // namespace detail
+
+// Start `t` now and let it run to completion on its own. Exceptions escaping it
+// are reported on stderr.
+inline void spawn(task<void> t) {
+    [](task<void> t) -> detail::detached {
+        try {
+            co_await t;
+        } catch (const std::exception& e) {
+            std::cerr << "Unhandled exception in spawned task: " << e.what() << std::endl;
+        }
+    }(std::move(t));
+}
+
+// Start `t` and block the calling thread until it has finished
+template<class T>
+T sync_wait(task<T> t) {
+    // Signalled under the mutex so the waiter cannot return (and destroy these
+    // locals) while the coroutine is still touching them
+    struct State {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done = false;
+        std::exception_ptr error;
+        std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> result;
+    } state;
+
+    [](task<T> t, State& state) -> detail::detached {
+        try {
+            if constexpr (std::is_void_v<T>) {
+                co_await t;
+                state.result.emplace(true);
+            } else {
+                state.result.emplace(co_await t);
+            }
+        } catch (...) {
+            state.error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.done = true;
+        state.cv.notify_one();
+    }(std::move(t), state);
+
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.cv.wait(lock, [&state] { return state.done; });
+    if (state.error) std::rethrow_exception(state.error);
+    if constexpr (!std::is_void_v<T>) return std::move(*state.result);
+}
+
+// `co_await schedule_on(executor)` continues the coroutine on `executor`.
+// Works with anything that has post(fn) (e.g. ThreadPool), or for which an
+// ADL-visible post(executor, fn) exists (e.g. boost::asio::io_context).
+template<class Executor>
+auto schedule_on(Executor& executor) {
+    struct awaiter {
+        Executor& executor;
+
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            auto resume = [handle] { handle.resume(); };
+            if constexpr (requires { executor.post(resume); }) {
+                executor.post(resume);
+            } else {
+                post(executor, resume);
+            }
+        }
+        void await_resume() noexcept {}
+    };
+    return awaiter{executor};
+}
+
+}  // namespace coro
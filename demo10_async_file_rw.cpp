@@ -1,91 +1,440 @@
+#include "coro_asio.hpp"
+#include "aligned_buffer_pool.hpp" // 4 KiB-aligned buffers and open_direct for the O_DIRECT mode
+#include "file_transfer.hpp" // reflink, copy_file_range and splice strategies
 #include <boost/asio.hpp>
-#include <boost/bind/bind.hpp>
 #include <iostream>
-#include <fstream>
 #include <memory>
+#include <string> // Command-line mode selection
+#include <optional> // The splice pipe, made only if needed
+#include <vector> // Benchmark directories and data
+#include <fstream> // Writes the benchmark file
+#include <random> // Benchmark file contents
+#include <chrono> // Benchmark timing
+#include <cstdio> // std::printf, std::remove
+#include <cstdlib> // std::system, std::strtoull
+#include <algorithm> // std::min, std::max
+#include <cerrno> // errno
+#include <cstring> // std::strerror
+#include <unistd.h> // read, write, ftruncate, close, sync
+#include <coroutine> // Handles of the ring's waiting reader and writer
+#include <thread> // Second thread for the pipelined copy
+#include <atomic> // The ring's writer tells the reader it failed
+#include <utility> // std::exchange
 
 using boost::asio::io_service;
-using boost::asio::post;
 using namespace boost::asio::ip;
 
-// Handler class to manage asynchronous file operations
-class FileHandler : public std::enable_shared_from_this<FileHandler> {
+// How FileHandler copies
+struct FileCopyOptions {
+    bool direct = false; // O_DIRECT where the filesystem allows it
+    Transfer first = Transfer::reflink; // Strategy to try first
+    static constexpr std::size_t max_length = 1024; // The demo's original read/write length
+    std::size_t chunk = max_length; // Bytes per read/write step (rounded up to 4 KiB with O_DIRECT)
+    std::size_t buffers = 1; // Read/write loop: 1 alternates read and write, more pipeline them
+};
+
+// Handler class to manage asynchronous file operations.
+// The copy loop is a coroutine that hops onto the io_service between the read
+// and write steps, so it interleaves with other work like the posted version did
+// without a shared_from_this() per step.
+//
+// With `direct`, both files are opened with O_DIRECT (where the filesystem
+// allows it) so the copy bypasses the page cache. The chunk then comes from
+// an AlignedBufferPool, rounded up to 4 KiB, and the file's unaligned tail
+// is written as a whole block and truncated off afterwards.
+//
+// Otherwise the bytes go the cheapest way the files allow, starting from
+// `first`: a reflink clone, then copy_file_range, then splice through a pipe
+// (kernel_chunk bytes per step, hopping onto the io_service between steps),
+// and the read/write loop through the buffer only as a last resort. A
+// strategy the filesystems or kernel refuse hands over to the next one at
+// the current offset. direct() copies always take the read/write loop,
+// which is the one that keeps to aligned blocks.
+//
+// With more than one buffer, the read/write loop becomes a ring: a reader
+// on one strand fills buffers while a writer on another strand empties
+// them, so the read of chunk k+1 overlaps the write of chunk k (given a
+// second thread running the io_service). Each side owns its count of
+// buffers, touched only on its own strand, and hands buffers over by
+// posting to the other side's strand; there is no lock.
+class FileHandler {
 public:
-    FileHandler(io_service& io_service, const std::string& input_file, const std::string& output_file)
+    FileHandler(io_service& io_service, const std::string& input_file, const std::string& output_file,
+                const FileCopyOptions& options = {})
         : io_service_(io_service),
           input_file_(input_file),
           output_file_(output_file),
-          input_stream_(input_file, std::ios::binary),
-          output_stream_(output_file, std::ios::binary) {
-
-        if (!input_stream_.is_open()) {
-            throw std::runtime_error("Failed to open input file: " + input_file_);
+          input_direct_(options.direct),
+          output_direct_(options.direct),
+          transfer_(options.direct ? Transfer::buffered : options.first),
+          buffers_(options.direct ? align_up(options.chunk) : options.chunk, std::max<std::size_t>(options.buffers, 1)),
+          data_(buffers_.acquire()),
+          read_strand_(boost::asio::make_strand(io_service)),
+          write_strand_(boost::asio::make_strand(io_service)) {
+        input_fd_ = open_direct(input_file.c_str(), O_RDONLY, 0, input_direct_);
+        if (input_fd_ < 0) {
+            throw std::runtime_error("Failed to open input file: " + input_file_ + ": " + std::strerror(errno));
         }
 
-        if (!output_stream_.is_open()) {
-            throw std::runtime_error("Failed to open output file: " + output_file_);
+        output_fd_ = open_direct(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644, output_direct_);
+        if (output_fd_ < 0) {
+            ::close(input_fd_);
+            throw std::runtime_error("Failed to open output file: " + output_file_ + ": " + std::strerror(errno));
         }
+        chunk_ = input_direct_ || output_direct_ ? buffers_.buffer_size() : options.chunk;
     }
 
-    // Start the asynchronous read/write process
-    void start() {
-        async_read();
+    ~FileHandler() {
+        ::close(input_fd_);
+        ::close(output_fd_);
     }
 
-private:
-    // Asynchronously read data from the input file
-    void async_read() {
-        auto self(shared_from_this());
-        post(io_service_, [this, self]() {
-            input_stream_.read(data_, max_length);
-            std::size_t length = input_stream_.gcount();
-
-            if (length > 0) {
-                async_write(length);
+    // False if O_DIRECT was asked for but the filesystem of either file rejected it
+    bool direct() const { return input_direct_ && output_direct_; }
+
+    // The strategy that finished the copy (once start() is done)
+    Transfer transfer() const { return transfer_; }
+
+    // Copy the input file to the output file
+    coro::task<void> start() {
+        if (transfer_ == Transfer::reflink) {
+            if (reflink(input_fd_, output_fd_)) {
+                std::cout << "File processing completed (reflink)." << std::endl;
+                co_return;
+            }
+            if (!transfer_unsupported(errno)) {
+                std::cerr << "Error cloning input file: " << std::strerror(errno) << std::endl;
+                co_return;
+            }
+            transfer_ = next_transfer(transfer_);
+        }
+
+        std::optional<SplicePipe> pipe;
+        while (transfer_ != Transfer::buffered) {
+            co_await coro::schedule_on(io_service_);
+            if (transfer_ == Transfer::splice && !pipe) pipe.emplace(kernel_chunk);
+            ssize_t n = transfer_ == Transfer::copy_file_range ? copy_range_step(input_fd_, output_fd_, kernel_chunk)
+                                                               : pipe->step(input_fd_, output_fd_, kernel_chunk);
+            if (n > 0) {
+                copied_ += n;
+            } else if (n == 0) {
+                std::cout << "File processing completed (" << transfer_name(transfer_) << ")." << std::endl;
+                co_return;
+            } else if (transfer_unsupported(errno)) {
+                transfer_ = next_transfer(transfer_);
             } else {
-                // Close streams when done
-                input_stream_.close();
-                output_stream_.close();
-                std::cout << "File processing completed." << std::endl;
+                std::cerr << "Error copying file: " << std::strerror(errno) << std::endl;
+                co_return;
+            }
+        }
+
+        if (buffers_.count() > 1) {
+            coro::spawn(read_ahead());
+            if (!co_await write_behind()) co_return;
+        } else {
+            for (;;) {
+                co_await coro::schedule_on(io_service_);
+                ssize_t length = read(data_);
+                if (length < 0) co_return;
+                if (length == 0) break;
+
+                co_await coro::schedule_on(io_service_);
+                if (!write(data_, static_cast<std::size_t>(length))) {
+                    std::cerr << "Error writing to output file: " << std::strerror(errno) << std::endl;
+                    co_return;
+                }
+                copied_ += length;
             }
+        }
+
+        // A direct write of the tail went out as a whole block: cut the padding
+        if (output_direct_ && copied_ % direct_alignment != 0 && ::ftruncate(output_fd_, copied_) != 0) {
+            std::cerr << "Error truncating output file: " << std::strerror(errno) << std::endl;
+            co_return;
+        }
+        std::cout << "File processing completed (buffered)." << std::endl;
+    }
+
+private:
+    // Buffers one side of the ring may use; only touched on that side's strand
+    struct RingSide {
+        std::size_t available = 0;
+        std::coroutine_handle<> waiting; // That side's coroutine, when it ran out
+    };
+
+    // Suspend until `side` has a buffer, and take it
+    static auto take(RingSide& side) {
+        struct awaiter {
+            RingSide& side;
+
+            bool await_ready() const noexcept { return side.available > 0; }
+            void await_suspend(std::coroutine_handle<> handle) noexcept { side.waiting = handle; }
+            void await_resume() noexcept { --side.available; }
+        };
+        return awaiter{side};
+    }
+
+    // Give `side` (whose strand is `strand`) one more buffer
+    template<class Strand>
+    static void give(Strand& strand, RingSide& side) {
+        boost::asio::post(strand, [&side] {
+            ++side.available;
+            if (auto waiting = std::exchange(side.waiting, nullptr)) waiting.resume();
         });
     }
 
-    // Asynchronously write data to the output file
-    void async_write(std::size_t length) {
-        auto self(shared_from_this());
-        post(io_service_, [this, self, length]() {
-            output_stream_.write(data_, length);
+    // Fill buffers in ring order, handing each to the writer; an empty one
+    // (end of file, or a failed writer) ends the copy, and one of length -1
+    // (a read error) fails it
+    coro::task<void> read_ahead() {
+        co_await coro::schedule_on(read_strand_);
+        free_.available = buffers_.count();
+        for (std::size_t k = 0;; ++k) {
+            co_await take(free_);
+            std::size_t slot = k % buffers_.count();
+            lengths_[slot] = write_failed_.load(std::memory_order_relaxed) ? 0 : read(buffers_.buffer(slot));
+            bool last = lengths_[slot] <= 0;
+            give(write_strand_, filled_);
+            if (last) co_return;
+        }
+    }
 
-            if (output_stream_) {
-                async_read();
-            } else {
-                std::cerr << "Error writing to output file." << std::endl;
+    // Write buffers in ring order, handing each back to the reader; false on a read or write error
+    coro::task<bool> write_behind() {
+        co_await coro::schedule_on(write_strand_);
+        bool ok = true;
+        for (std::size_t k = 0;; ++k) {
+            co_await take(filled_);
+            std::size_t slot = k % buffers_.count();
+            if (lengths_[slot] < 0) ok = false;
+            if (lengths_[slot] <= 0) break;
+            if (ok && !write(buffers_.buffer(slot), static_cast<std::size_t>(lengths_[slot]))) {
+                std::cerr << "Error writing to output file: " << std::strerror(errno) << std::endl;
+                ok = false;
+                write_failed_.store(true, std::memory_order_relaxed); // The reader stops at its next buffer
             }
-        });
+            if (ok) copied_ += lengths_[slot];
+            give(read_strand_, free_);
+        }
+        co_return ok;
+    }
+
+    // Read the next chunk of the input file into `buffer`: its length, 0 at
+    // the end, -1 on error. A direct read only comes back short at the end of
+    // the file.
+    ssize_t read(char* buffer) {
+        std::size_t length = 0;
+        while (length < chunk_) {
+            ssize_t n = ::read(input_fd_, buffer + length, chunk_ - length);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                std::cerr << "Error reading input file: " << std::strerror(errno) << std::endl;
+                return -1;
+            }
+            length += n;
+            if (n == 0 || input_direct_) break;
+        }
+        return static_cast<ssize_t>(length);
+    }
+
+    // Write a chunk from `buffer` to the output file; a direct write rounds
+    // the (last, short) chunk up to whole blocks
+    bool write(const char* buffer, std::size_t length) {
+        std::size_t total = output_direct_ ? align_up(length) : length;
+        for (std::size_t done = 0; done < total;) {
+            ssize_t n = ::write(output_fd_, buffer + done, total - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            done += n;
+        }
+        return true;
     }
 
     io_service& io_service_; // IO service
 
     std::string input_file_; // Input file name
     std::string output_file_; // Output file name
-    std::ifstream input_stream_; // Input file stream
-    std::ofstream output_stream_; // Output file stream
+    int input_fd_ = -1; // Input file descriptor
+    int output_fd_ = -1; // Output file descriptor
+    bool input_direct_; // Opened with O_DIRECT
+    bool output_direct_;
+
+    Transfer transfer_; // Strategy in use
 
-    enum { max_length = 1024 }; // Maximum length of data to read/write
-    char data_[max_length]; // Data buffer
+    static constexpr std::size_t kernel_chunk = 1 << 20; // Bytes per copy_file_range / splice step
+    AlignedBufferPool buffers_; // The data buffers: one, or the ring
+    char* data_; // Data buffer of the alternating loop
+    std::size_t chunk_; // Bytes per read
+    off_t copied_ = 0; // Bytes written so far (by the writer, in the ring)
+
+    boost::asio::strand<io_service::executor_type> read_strand_; // The ring's reader runs here
+    boost::asio::strand<io_service::executor_type> write_strand_; // and its writer here
+    RingSide free_; // Buffers the reader may fill (reader's strand)
+    RingSide filled_; // Buffers the writer may write out (writer's strand)
+    std::vector<ssize_t> lengths_ = std::vector<ssize_t>(buffers_.count()); // Bytes in each ring buffer (-1: read error)
+    std::atomic<bool> write_failed_{false};
 };
 
+// Copy `input` to `output` on an io_service run by one thread, or two for a
+// ring of buffers (its reader and writer then run side by side); returns the
+// strategy that finished the copy
+Transfer copy_file(const std::string& input, const std::string& output, const FileCopyOptions& options, bool quiet = false) {
+    io_service io_service;
+    FileHandler handler(io_service, input, output, options);
+    if (options.direct && !handler.direct()) std::cout << "O_DIRECT rejected by the filesystem; using the page cache" << std::endl;
+    std::streambuf* saved = quiet ? std::cout.rdbuf(nullptr) : nullptr; // Quiets the completion message
+    coro::spawn(handler.start());
+    std::thread second;
+    if (options.buffers > 1) second = std::thread([&io_service] { io_service.run(); });
+    io_service.run();
+    if (second.joinable()) second.join();
+    if (quiet) std::cout.rdbuf(saved);
+    return handler.transfer();
+}
+
+// Writes `size_mb` MiB of random bytes to `path`
+bool make_file(const std::string& path, std::uint64_t size_mb) {
+    std::vector<char> block(1 << 20);
+    std::mt19937_64 random(1);
+    for (auto& c : block) c = static_cast<char>(random());
+    std::ofstream out(path, std::ios::binary);
+    for (std::uint64_t i = 0; i < size_mb; ++i) out.write(block.data(), static_cast<std::streamsize>(block.size()));
+    return static_cast<bool>(out);
+}
+
+// Time `copy`, including fdatasync of `destination`, after writing back
+// everything earlier so it does not slow this copy down
+template<class Copy>
+double timed_copy(const std::string& destination, Copy copy) {
+    std::remove(destination.c_str());
+    ::sync();
+    auto start = std::chrono::steady_clock::now();
+    copy();
+    int fd = ::open(destination.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        ::fdatasync(fd);
+        ::close(fd);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool same_file(const std::string& a, const std::string& b) {
+    return std::system(("cmp -s '" + a + "' '" + b + "'").c_str()) == 0;
+}
+
+// Copies a `size_mb` MiB file with the read/write loop: alternating read and
+// write (1 KiB chunks, as this demo used to, then larger ones) against a
+// ring of 2 and 4 buffers, through the page cache and with O_DIRECT (where
+// reads and writes really wait on the device, so overlapping them pays most)
+void run_pipeline_benchmark(std::uint64_t size_mb, const std::string& dir) {
+    std::string source = dir + "/demo10_pipeline.src";
+    std::string destination = dir + "/demo10_pipeline.dst";
+    if (!make_file(source, size_mb)) {
+        std::cerr << "Cannot write " << source << std::endl;
+        return;
+    }
+    struct Row {
+        std::size_t chunk;
+        std::size_t buffers;
+    };
+    std::vector<Row> rows = {{1024, 1}};
+    for (std::size_t chunk : {64 << 10, 1 << 20, 8 << 20}) {
+        for (std::size_t buffers : {1, 2, 4}) rows.push_back({chunk, buffers});
+    }
+
+    std::printf("%llu MiB in %s, read/write loop\n", static_cast<unsigned long long>(size_mb), dir.c_str());
+    std::printf("%10s %8s %14s %14s\n", "chunk KiB", "buffers", "cache GB/s", "O_DIRECT GB/s");
+    for (const Row& row : rows) {
+        std::printf("%10zu %8zu", row.chunk / 1024, row.buffers);
+        for (bool direct : {false, true}) {
+            FileCopyOptions options;
+            options.first = Transfer::buffered;
+            options.direct = direct;
+            options.chunk = row.chunk;
+            options.buffers = row.buffers;
+            double seconds = timed_copy(destination, [&] { copy_file(source, destination, options, true); });
+            std::printf(" %14.2f%s", (size_mb << 20) / seconds / 1e9, same_file(source, destination) ? "" : " (differs)");
+        }
+        std::printf("\n");
+    }
+    std::remove(source.c_str());
+    std::remove(destination.c_str());
+}
+
+// Copies a `size_mb` MiB file in each directory (say a tmpfs, an ext4 and an
+// XFS loopback mount) with each strategy first in line, and prints the time
+// including fdatasync of the copy, and the strategy that actually ran.
+void run_benchmark(std::uint64_t size_mb, const std::vector<std::string>& dirs) {
+    std::printf("%-24s %-16s %-16s %10s %8s\n", "directory", "first", "used", "ms", "GB/s");
+    for (const auto& dir : dirs) {
+        std::string source = dir + "/demo10_bench.src";
+        std::string destination = dir + "/demo10_bench.dst";
+        if (!make_file(source, size_mb)) {
+            std::cerr << "Cannot write " << source << std::endl;
+            continue;
+        }
+        // An untimed first copy, so the first timed one does not pay for warming up the filesystem
+        bool warm_up = true;
+        for (Transfer first : {Transfer::buffered, Transfer::reflink, Transfer::copy_file_range, Transfer::splice, Transfer::buffered}) {
+            FileCopyOptions options;
+            options.first = first;
+            Transfer used;
+            double seconds = timed_copy(destination, [&] { used = copy_file(source, destination, options, true); });
+            if (warm_up) {
+                warm_up = false;
+                continue;
+            }
+            std::printf("%-24s %-16s %-16s %10.1f %8.2f%s\n", dir.c_str(), transfer_name(first), transfer_name(used),
+                        seconds * 1e3, (size_mb << 20) / seconds / 1e9, same_file(source, destination) ? "" : "  (copy differs)");
+        }
+        std::remove(source.c_str());
+        std::remove(destination.c_str());
+    }
+}
+
 int main(int argc, char* argv[]) {
     try {
-        if (argc != 3) {
-            std::cerr << "Usage: AsyncFileIO <input_file> <output_file>\n";
-            return 1;
+        if (argc >= 2 && std::string(argv[1]) == "bench") {
+            std::uint64_t size_mb = argc >= 3 ? std::strtoull(argv[2], nullptr, 10) : 256;
+            std::vector<std::string> dirs(argv + std::min(argc, 3), argv + argc);
+            if (dirs.empty()) dirs.push_back(".");
+            run_benchmark(size_mb, dirs);
+            return 0;
+        }
+
+        if (argc >= 2 && std::string(argv[1]) == "pipeline") {
+            std::uint64_t size_mb = argc >= 3 ? std::strtoull(argv[2], nullptr, 10) : 256;
+            run_pipeline_benchmark(size_mb, argc >= 4 ? argv[3] : ".");
+            return 0;
         }
 
-        io_service io_service;
-        std::make_shared<FileHandler>(io_service, argv[1], argv[2])->start();
-        io_service.run();
+        // Optional arguments after the files: "direct", the strategy to try
+        // first, chunk=<KiB> (64 KiB to 8 MiB) and buffers=<ring size>
+        FileCopyOptions options;
+        bool usage = argc < 3;
+        for (int i = 3; i < argc && !usage; ++i) {
+            std::string arg = argv[i];
+            if (arg == "direct") {
+                options.direct = true;
+            } else if (arg.rfind("chunk=", 0) == 0) {
+                std::size_t kib = std::strtoull(arg.c_str() + 6, nullptr, 10);
+                usage = kib < 64 || kib > 8192;
+                options.chunk = kib * 1024;
+            } else if (arg.rfind("buffers=", 0) == 0) {
+                options.buffers = std::strtoull(arg.c_str() + 8, nullptr, 10);
+                usage = options.buffers < 1 || options.buffers > 64;
+            } else {
+                usage = !parse_transfer(arg, options.first);
+            }
+        }
+        if (usage) {
+            std::cerr << "Usage: AsyncFileIO <input_file> <output_file> [direct] [reflink | copy_file_range | splice | buffered]\n"
+                         "                   [chunk=<64..8192 KiB>] [buffers=<1..64>]\n";
+            std::cerr << "       AsyncFileIO bench [size_mb [dir...]]\n";
+            std::cerr << "       AsyncFileIO pipeline [size_mb [dir]]\n";
+            return 1;
+        }
+        copy_file(argv[1], argv[2], options);
     } catch (std::exception& e) {
         std::cerr << "Exception: " << e.what() << "\n";
     }
@@ -1,13 +1,15 @@
+#include "aligned_buffer_pool.hpp" // 4 KiB-aligned buffers and open_direct for the O_DIRECT mode
 #include <aio.h>
 #include <fcntl.h>
 #include <iostream>
 #include <cstring>
+#include <string>
 #include <unistd.h>
 #include <csignal>
 #include <mutex>
 #include <condition_variable>
 
-const int BUFFER_SIZE = 1024;  // Size of the buffer for asynchronous operations
+const int BUFFER_SIZE = 1024;  // Size of the buffer for asynchronous operations (a 4 KiB block with O_DIRECT)
 
 // Function to handle errors by printing a message and exiting
 void handle_error(const char* msg) {
@@ -19,8 +21,13 @@ void handle_error(const char* msg) {
 struct aio_data {
     aiocb aiocb_read;  // Control block for the asynchronous read operation
     aiocb aiocb_write;  // Control block for the asynchronous write operation
+    int input_fd;  // File descriptor for the input file
     int output_fd;  // File descriptor for the output file
     off_t offset;  // Current offset for reading from the input file
+    char* buffer;  // Buffer shared by the read and the write that follows it
+    size_t buffer_size;  // Bytes per read
+    bool output_direct;  // The output was opened with O_DIRECT: writes are whole blocks
+    AlignedBufferPool* buffers;  // Where the buffer came from
 };
 
 // Condition variable and mutex to signal the completion of asynchronous operations
@@ -28,113 +35,137 @@ std::condition_variable cv;
 std::mutex cv_m;
 bool done = false;  // Flag to indicate if the operations are complete
 
-// Callback function for handling the completion of asynchronous read and write operations
-void aio_completion_handler(sigval_t sigval) {
+void read_completion_handler(sigval_t sigval);
+void write_completion_handler(sigval_t sigval);
+
+// Set up `cb` for an operation on `fd` that reports to `handler`
+void prepare(aiocb* cb, aio_data* data, int fd, size_t length, void (*handler)(sigval_t)) {
+    memset(cb, 0, sizeof(struct aiocb));
+    cb->aio_fildes = fd;
+    cb->aio_buf = data->buffer;
+    cb->aio_nbytes = length;
+    cb->aio_offset = data->offset;
+    cb->aio_sigevent.sigev_notify = SIGEV_THREAD;
+    cb->aio_sigevent.sigev_notify_function = handler;
+    cb->aio_sigevent.sigev_notify_attributes = nullptr;
+    cb->aio_sigevent.sigev_value.sival_ptr = data;
+}
+
+// Read the next chunk at data->offset
+void start_read(aio_data* data) {
+    prepare(&data->aiocb_read, data, data->input_fd, data->buffer_size, read_completion_handler);
+    if (aio_read(&data->aiocb_read) == -1) {
+        handle_error("aio_read");
+    }
+}
+
+// Close the files, free everything and wake the main thread
+void finish(aio_data* data) {
+    // A direct write of the tail went out as a whole block: cut the padding
+    if (data->output_direct && data->offset % direct_alignment != 0 && ftruncate(data->output_fd, data->offset) != 0) {
+        handle_error("ftruncate");
+    }
+    close(data->input_fd);  // Close the input file descriptor
+    close(data->output_fd);  // Close the output file descriptor
+    data->buffers->release(data->buffer);
+    delete data;  // Delete the aio_data structure
+    // Signal the main thread to stop waiting
+    {
+        std::lock_guard<std::mutex> lock(cv_m);
+        done = true;
+    }
+    cv.notify_one();
+}
+
+// A read finished: write what it read, from the same buffer and offset.
+// The next read only starts once that write is done, since it reuses the buffer.
+void read_completion_handler(sigval_t sigval) {
     auto data = static_cast<aio_data*>(sigval.sival_ptr);
     auto aiocb_read = &(data->aiocb_read);
-    auto aiocb_write = &(data->aiocb_write);
 
     int err = aio_error(aiocb_read);  // Check the status of the read operation
-    if (err == 0) {
-        int bytes_read = aio_return(aiocb_read);  // Get the number of bytes read
-
-        if (bytes_read > 0) {
-            // Update the offset for the next read operation
-            data->offset += bytes_read;
-
-            // Set up the control block for the write operation
-            memset(aiocb_write, 0, sizeof(struct aiocb));
-            aiocb_write->aio_fildes = data->output_fd;
-            aiocb_write->aio_buf = aiocb_read->aio_buf;
-            aiocb_write->aio_nbytes = bytes_read;
-            aiocb_write->aio_offset = aiocb_read->aio_offset;
-            aiocb_write->aio_sigevent.sigev_notify = SIGEV_THREAD;
-            aiocb_write->aio_sigevent.sigev_notify_function = aio_completion_handler;
-            aiocb_write->aio_sigevent.sigev_notify_attributes = nullptr;
-            aiocb_write->aio_sigevent.sigev_value.sival_ptr = data;
-
-            // Start the asynchronous write operation
-            if (aio_write(aiocb_write) == -1) {
-                handle_error("aio_write");
-            }
-
-            // Prepare for the next read operation
-            memset(aiocb_read, 0, sizeof(struct aiocb));
-            aiocb_read->aio_fildes = aiocb_write->aio_fildes;
-            aiocb_read->aio_buf = aiocb_write->aio_buf;
-            aiocb_read->aio_nbytes = BUFFER_SIZE;
-            aiocb_read->aio_offset = data->offset;
-            aiocb_read->aio_sigevent.sigev_notify = SIGEV_THREAD;
-            aiocb_read->aio_sigevent.sigev_notify_function = aio_completion_handler;
-            aiocb_read->aio_sigevent.sigev_notify_attributes = nullptr;
-            aiocb_read->aio_sigevent.sigev_value.sival_ptr = data;
-
-            // Start the next asynchronous read operation
-            if (aio_read(aiocb_read) == -1) {
-                handle_error("aio_read");
-            }
-        } else {
-            // If bytes_read is 0, we've reached the end of the file
-            close(aiocb_read->aio_fildes);  // Close the input file descriptor
-            close(data->output_fd);  // Close the output file descriptor
-            delete[] static_cast<char*>(const_cast<void*>(aiocb_read->aio_buf));  // Free the buffer memory
-            delete data;  // Delete the aio_data structure
-            // Signal the main thread to stop waiting
-            {
-                std::lock_guard<std::mutex> lock(cv_m);
-                done = true;
-            }
-            cv.notify_one();
-        }
-    } else {
-        // Handle errors in the read operation
+    if (err != 0) {
         std::cerr << "aio_read error: " << strerror(err) << std::endl;
-        handle_error("aio_read");
+        exit(EXIT_FAILURE);
+    }
+    ssize_t bytes_read = aio_return(aiocb_read);  // Get the number of bytes read
+    if (bytes_read == 0) {
+        // We've reached the end of the file
+        finish(data);
+        return;
     }
+
+    // A direct read comes back short only at the end of the file; that tail
+    // is written as a whole block (the buffer is big enough) and truncated later
+    size_t length = data->output_direct ? align_up(bytes_read) : bytes_read;
+    prepare(&data->aiocb_write, data, data->output_fd, length, write_completion_handler);
+    data->offset += bytes_read;  // Update the offset for the next read operation
+    if (aio_write(&data->aiocb_write) == -1) {
+        handle_error("aio_write");
+    }
+}
+
+// A write finished: read the next chunk
+void write_completion_handler(sigval_t sigval) {
+    auto data = static_cast<aio_data*>(sigval.sival_ptr);
+    auto aiocb_write = &(data->aiocb_write);
+
+    int err = aio_error(aiocb_write);  // Check the status of the write operation
+    if (err != 0) {
+        std::cerr << "aio_write error: " << strerror(err) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (static_cast<size_t>(aio_return(aiocb_write)) != aiocb_write->aio_nbytes) {
+        std::cerr << "aio_write: short write" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    start_read(data);
 }
 
-// Function to start the asynchronous read operation
-void async_read(const char* input_file, const char* output_file) {
+// Function to start the asynchronous read operation. With `direct`, both
+// files are opened with O_DIRECT where the filesystem allows it.
+void async_read(const char* input_file, const char* output_file, AlignedBufferPool& buffers, bool direct) {
     // Open the input file for reading
-    int input_fd = open(input_file, O_RDONLY);
+    bool input_direct = direct;
+    int input_fd = open_direct(input_file, O_RDONLY, 0, input_direct);
     if (input_fd == -1) {
         handle_error("open input_file");
     }
 
     // Open the output file for writing, creating it if necessary
-    int output_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool output_direct = direct;
+    int output_fd = open_direct(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644, output_direct);
     if (output_fd == -1) {
         handle_error("open output_file");
     }
+    if (direct && !(input_direct && output_direct)) {
+        std::cout << "O_DIRECT rejected by the filesystem; using the page cache" << std::endl;
+    }
 
     // Initialize the aio_data structure
     auto data = new aio_data;
-    memset(&(data->aiocb_read), 0, sizeof(struct aiocb));
-    data->aiocb_read.aio_fildes = input_fd;
-    data->aiocb_read.aio_buf = new char[BUFFER_SIZE];
-    data->aiocb_read.aio_nbytes = BUFFER_SIZE;
-    data->aiocb_read.aio_offset = 0;
-    data->aiocb_read.aio_sigevent.sigev_notify = SIGEV_THREAD;
-    data->aiocb_read.aio_sigevent.sigev_notify_function = aio_completion_handler;
-    data->aiocb_read.aio_sigevent.sigev_notify_attributes = nullptr;
-    data->aiocb_read.aio_sigevent.sigev_value.sival_ptr = data;
+    data->input_fd = input_fd;
     data->output_fd = output_fd;
     data->offset = 0;  // Initialize the offset for reading
+    data->buffers = &buffers;
+    data->buffer = buffers.acquire();
+    data->buffer_size = input_direct || output_direct ? buffers.buffer_size() : BUFFER_SIZE;
+    data->output_direct = output_direct;
 
     // Start the initial asynchronous read operation
-    if (aio_read(&(data->aiocb_read)) == -1) {
-        handle_error("aio_read");
-    }
+    start_read(data);
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cerr << "Usage: AsyncFileIO <input_file> <output_file>\n";
+    if (argc != 3 && !(argc == 4 && std::string(argv[3]) == "direct")) {
+        std::cerr << "Usage: AsyncFileIO <input_file> <output_file> [direct]\n";
         return 1;
     }
+    bool direct = argc == 4;
+    AlignedBufferPool buffers(direct ? align_up(BUFFER_SIZE) : BUFFER_SIZE, 1);
 
     // Start the asynchronous read operation
-    async_read(argv[1], argv[2]);
+    async_read(argv[1], argv[2], buffers, direct);
 
     // Wait for the asynchronous operations to complete
     std::unique_lock<std::mutex> lk(cv_m);
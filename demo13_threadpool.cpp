@@ -5,38 +5,102 @@
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+
+#include "async_log.hpp"
+
+// Monotonic timestamp used by the trace
+inline uint64_t trace_now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// One task execution as seen by a worker
+struct TraceEvent {
+    uint64_t enqueue_ns;  // When the task was submitted
+    uint64_t start_ns;    // When the worker started running it
+    uint64_t end_ns;      // When it returned
+    uint32_t worker;
+};
+
+// Fixed-size ring of TraceEvents written by exactly one worker: no locks and no
+// I/O on the worker's path. Once full, the oldest events are overwritten.
+class TraceRing {
+public:
+    explicit TraceRing(size_t capacity) : events_(new TraceEvent[capacity]), capacity_(capacity) {}
+
+    void record(const TraceEvent& event) {
+        uint64_t h = head_.load(std::memory_order_relaxed);
+        events_[h % capacity_] = event;
+        head_.store(h + 1, std::memory_order_release);
+    }
+
+    // Visit the retained events, oldest first
+    template<class F>
+    void for_each(F&& visit) const {
+        uint64_t h = head_.load(std::memory_order_acquire);
+        uint64_t first = h > capacity_ ? h - capacity_ : 0;
+        for (uint64_t n = first; n < h; ++n) visit(events_[n % capacity_]);
+    }
+
+private:
+    std::unique_ptr<TraceEvent[]> events_;
+    uint64_t capacity_;
+    std::atomic<uint64_t> head_{0};  // Total events ever recorded
+};
 
 class ThreadPool {
 public:
-    // Constructor: Create a thread pool with a given number of threads
-    ThreadPool(size_t threads);
+    // Constructor: Create a thread pool with a given number of threads.
+    // With trace_capacity > 0 each worker keeps that many recent TraceEvents.
+    ThreadPool(size_t threads, size_t trace_capacity = 0);
     // Destructor: Clean up all threads
     ~ThreadPool();
 
+    // Run every queued task, then join the workers; enqueue throws afterwards
+    void shutdown();
+
     // Add a new task to the pool
     void enqueue(std::function<void()> task);
 
+    // Write the recorded task executions in Chrome trace format (chrome://tracing).
+    // Workers record without locks, so call it after shutdown().
+    void export_chrome_trace(std::ostream& out) const;
+
 private:
     // Vector of worker threads
     std::vector<std::thread> workers;
-    // Task queue
-    std::queue<std::function<void()>> tasks;
+    // Task queue, with the submission time of each task
+    struct QueuedTask {
+        std::function<void()> fn;
+        uint64_t enqueued_ns;
+    };
+    std::queue<QueuedTask> tasks;
 
     // Synchronization
     std::mutex queue_mutex;
     std::condition_variable condition;
     bool stop;
 
-    // Mutex for synchronizing console output
-    std::mutex print_mutex;
+    // Per-worker trace rings (empty when tracing is disabled)
+    std::vector<std::unique_ptr<TraceRing>> traces;
 };
 
 // Constructor: Initialize the thread pool
-ThreadPool::ThreadPool(size_t threads) : stop(false) {
+ThreadPool::ThreadPool(size_t threads, size_t trace_capacity) : stop(false) {
+    if (trace_capacity > 0) {
+        for (size_t i = 0; i < threads; ++i) traces.emplace_back(new TraceRing(trace_capacity));
+    }
     for (size_t i = 0; i < threads; ++i) {
         workers.emplace_back([this, i] {
             for (;;) {
-                std::function<void()> task;
+                QueuedTask task;
 
                 // Lock the task queue
                 {
@@ -49,16 +113,12 @@ ThreadPool::ThreadPool(size_t threads) : stop(false) {
                     this->tasks.pop();
                 } // Release lock
 
-                {
-                    // Lock for printing
-                    std::lock_guard<std::mutex> lock(this->print_mutex);
-                    std::cout << "Thread " << i << " executing task." << std::endl;
-                }
-                task();
-                {
-                    // Lock for printing
-                    std::lock_guard<std::mutex> lock(this->print_mutex);
-                    std::cout << "Thread " << i << " finished task." << std::endl;
+                if (traces.empty()) {
+                    task.fn();
+                } else {
+                    uint64_t start = trace_now_ns();
+                    task.fn();
+                    traces[i]->record({task.enqueued_ns, start, trace_now_ns(), static_cast<uint32_t>(i)});
                 }
             }
         });
@@ -67,12 +127,18 @@ ThreadPool::ThreadPool(size_t threads) : stop(false) {
 
 // Destructor: Join all worker threads
 ThreadPool::~ThreadPool() {
+    shutdown();
+}
+
+void ThreadPool::shutdown() {
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
         stop = true;
     }
     condition.notify_all();
-    for (std::thread &worker : workers) worker.join();
+    for (std::thread &worker : workers) {
+        if (worker.joinable()) worker.join();
+    }
 }
 
 // Add a new work item to the pool
@@ -80,40 +146,65 @@ void ThreadPool::enqueue(std::function<void()> task) {
     {
         std::unique_lock<std::mutex> lock(queue_mutex);
         if (stop) throw std::runtime_error("enqueue on stopped ThreadPool");
-        tasks.emplace(std::move(task));
+        tasks.push({std::move(task), traces.empty() ? 0 : trace_now_ns()});
     }
     condition.notify_one();
 }
 
-// Example function to run as a task
-void example_function(int n, std::mutex &print_mutex) {
-    {
-        // Lock for printing
-        std::lock_guard<std::mutex> lock(print_mutex);
-        std::cout << "Task " << n << " is running." << std::endl;
+void ThreadPool::export_chrome_trace(std::ostream& out) const {
+    // Timestamps are relative to the earliest submission so the viewer starts at zero
+    uint64_t origin = UINT64_MAX;
+    for (const auto& ring : traces) {
+        ring->for_each([&origin](const TraceEvent& e) { origin = std::min(origin, e.enqueue_ns); });
     }
-    std::this_thread::sleep_for(std::chrono::seconds(1)); // Simulate work
-    {
-        // Lock for printing
-        std::lock_guard<std::mutex> lock(print_mutex);
-        std::cout << "Task " << n << " is finished." << std::endl;
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto& ring : traces) {
+        ring->for_each([&](const TraceEvent& e) {
+            out << (first ? "\n" : ",\n");
+            first = false;
+            out << "{\"name\":\"task\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.worker
+                << ",\"ts\":" << (e.start_ns - origin) / 1000.0
+                << ",\"dur\":" << (e.end_ns - e.start_ns) / 1000.0
+                << ",\"args\":{\"queue_wait_us\":" << (e.start_ns - e.enqueue_ns) / 1000.0 << "}}";
+        });
     }
+    out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    out.flags(flags);
+    out.precision(precision);
 }
 
-int main() {
-    // Create a thread pool with 3 threads
-    ThreadPool pool(3);
+// Example function to run as a task. Workers log through the async logger:
+// no console lock is held while a task runs.
+void example_function(int n) {
+    alog::info("Task ", n, " is running.");
+    std::this_thread::sleep_for(std::chrono::seconds(1)); // Simulate work
+    alog::info("Task ", n, " is finished.");
+}
 
-    // Mutex for synchronizing console output in tasks
-    std::mutex print_mutex;
+int main() {
+    // Create a thread pool with 3 threads that records when each task ran
+    ThreadPool pool(3, 256);
 
     // Enqueue 5 tasks
     for (int i = 0; i < 5; ++i) {
-        pool.enqueue([i, &print_mutex] { example_function(i, print_mutex); });
+        pool.enqueue([i] { example_function(i); });
     }
 
-    // Give some time for tasks to complete
+    // Give some time for tasks to complete, then for their log lines to be written
     std::this_thread::sleep_for(std::chrono::seconds(6));
+    alog::flush();
+
+    // Dump the schedule instead of printing from the workers, once they have stopped
+    pool.shutdown();
+    std::ofstream trace("demo13_trace.json");
+    pool.export_chrome_trace(trace);
+    std::cout << "Scheduling trace written to demo13_trace.json (open in chrome://tracing)" << std::endl;
 
     return 0;
 }
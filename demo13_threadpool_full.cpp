@@ -7,124 +7,1681 @@
 #include <functional>
 #include <future>
 #include <stdexcept>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <optional>
+#include <array>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <iterator>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "coro_task.hpp"
+#include "async_log.hpp"
+
+// Counts every global operator new, for the "alloc" self-check in main
+static std::atomic<size_t> g_allocations(0);
+
+// noinline keeps GCC from pairing the malloc/free calls across inlined new/delete
+[[gnu::noinline]] void* operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+// Lock-free work-stealing deque (Chase-Lev, with the C11 memory orderings from Le et al.)
+// The owning worker pushes and pops at the bottom; other workers steal from the top.
+// T must be trivially copyable (we store task pointers).
+template<class T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(int64_t capacity = 1024)
+        : top_(0), bottom_(0), array_(new Array(capacity)) {
+        garbage_.emplace_back(array_.load(std::memory_order_relaxed));
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only: push an item at the bottom
+    void push(T item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array* a = array_.load(std::memory_order_relaxed);
+
+        if (b - t > a->capacity - 1) a = grow(a, t, b);  // Deque is full
+
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only: pop an item from the bottom (LIFO, cache friendly)
+    bool pop(T& item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array* a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+
+        if (t > b) {  // Deque was empty
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        item = a->get(b);
+        if (t == b) {  // Last item: race against thieves for it
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                    std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread: steal an item from the top (FIFO)
+    bool steal(T& item) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+
+        if (t >= b) return false;  // Deque is empty
+
+        Array* a = array_.load(std::memory_order_acquire);
+        T candidate = a->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                          std::memory_order_relaxed)) {
+            return false;  // Lost the race to another thief or the owner
+        }
+        item = candidate;
+        return true;
+    }
+
+private:
+    // Circular array of atomics so that a racing thief never reads a torn value
+    struct Array {
+        explicit Array(int64_t cap) : capacity(cap), mask(cap - 1), buffer(new std::atomic<T>[cap]) {}
+
+        T get(int64_t i) const { return buffer[i & mask].load(std::memory_order_relaxed); }
+        void put(int64_t i, T item) { buffer[i & mask].store(item, std::memory_order_relaxed); }
+
+        int64_t capacity;  // Always a power of two
+        int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> buffer;
+    };
+
+    // Owner only: double the array. Old arrays stay alive until the deque is
+    // destroyed because a thief may still be reading from them.
+    Array* grow(Array* old, int64_t t, int64_t b) {
+        Array* bigger = new Array(old->capacity * 2);
+        for (int64_t i = t; i < b; ++i) bigger->put(i, old->get(i));
+        garbage_.emplace_back(bigger);
+        array_.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+    alignas(64) std::atomic<int64_t> top_;  // Thieves' end (own cache line)
+    alignas(64) std::atomic<int64_t> bottom_;  // Owner's end (own cache line)
+    std::atomic<Array*> array_;
+    std::vector<std::unique_ptr<Array>> garbage_;  // Every array ever allocated (owner only)
+};
+
+// Slab allocator: fixed-size blocks recycled through per-size-class free lists.
+// Blocks are carved from chunks that are only returned to the system when the
+// slab is destroyed, so once warmed up allocate/deallocate never touch malloc.
+class SlabAllocator {
+public:
+    static constexpr size_t max_block_size = 512;  // Larger requests go to the heap
+
+    SlabAllocator() = default;
+    SlabAllocator(const SlabAllocator&) = delete;
+    SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+    void* allocate(size_t bytes) {
+        if (bytes > max_block_size) return ::operator new(bytes);
+
+        SizeClass& sc = classes_[class_index(bytes)];
+        SpinLock lock(sc.lock);
+        if (!sc.free_list) refill(sc, class_size(class_index(bytes)));
+        FreeBlock* block = sc.free_list;
+        sc.free_list = block->next;
+        return block;
+    }
+
+    void deallocate(void* p, size_t bytes) {
+        if (bytes > max_block_size) {
+            ::operator delete(p);
+            return;
+        }
+
+        SizeClass& sc = classes_[class_index(bytes)];
+        SpinLock lock(sc.lock);
+        FreeBlock* block = static_cast<FreeBlock*>(p);
+        block->next = sc.free_list;
+        sc.free_list = block;
+    }
+
+private:
+    static constexpr size_t class_count = 4;  // 64, 128, 256, 512 bytes
+    static constexpr size_t blocks_per_chunk = 64;
+
+    struct FreeBlock { FreeBlock* next; };
+
+    struct SizeClass {
+        std::atomic_flag lock = ATOMIC_FLAG_INIT;
+        FreeBlock* free_list = nullptr;
+        std::vector<std::unique_ptr<unsigned char[]>> chunks;
+    };
+
+    // Critical sections are a handful of instructions, so spin instead of sleeping
+    struct SpinLock {
+        explicit SpinLock(std::atomic_flag& flag) : flag_(flag) {
+            while (flag_.test_and_set(std::memory_order_acquire)) std::this_thread::yield();
+        }
+        ~SpinLock() { flag_.clear(std::memory_order_release); }
+        std::atomic_flag& flag_;
+    };
+
+    static size_t class_index(size_t bytes) {
+        size_t index = 0;
+        while (class_size(index) < bytes) ++index;
+        return index;
+    }
+    static size_t class_size(size_t index) { return size_t(64) << index; }
+
+    // Called with the size class locked: carve a new chunk into free blocks
+    static void refill(SizeClass& sc, size_t block_size) {
+        sc.chunks.emplace_back(new unsigned char[block_size * blocks_per_chunk]);
+        unsigned char* chunk = sc.chunks.back().get();
+        for (size_t b = 0; b < blocks_per_chunk; ++b) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(chunk + b * block_size);
+            block->next = sc.free_list;
+            sc.free_list = block;
+        }
+    }
+
+    SizeClass classes_[class_count];
+};
+
+// Standard allocator adaptor over a shared SlabAllocator. The shared_ptr keeps the
+// slab alive for as long as any promise/future shared state allocated from it.
+template<class T>
+struct SlabStdAllocator {
+    using value_type = T;
+
+    explicit SlabStdAllocator(std::shared_ptr<SlabAllocator> slab) : slab(std::move(slab)) {}
+    template<class U>
+    SlabStdAllocator(const SlabStdAllocator<U>& other) : slab(other.slab) {}
+
+    T* allocate(size_t n) {
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned type");
+        return static_cast<T*>(slab->allocate(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t n) { slab->deallocate(p, n * sizeof(T)); }
+
+    template<class U>
+    bool operator==(const SlabStdAllocator<U>& other) const { return slab == other.slab; }
+    template<class U>
+    bool operator!=(const SlabStdAllocator<U>& other) const { return slab != other.slab; }
+
+    std::shared_ptr<SlabAllocator> slab;
+};
+
+// Move-only type-erased `void()` callable. Functors up to inline_capacity bytes are
+// stored inside the Task itself; only larger ones are placed on the heap.
+class Task {
+public:
+    static constexpr size_t inline_capacity = 64;
+
+    Task() noexcept = default;
+
+    template<class F, class = typename std::enable_if<!std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) {
+        using Fn = typename std::decay<F>::type;
+        if constexpr (fits_inline<Fn>()) {
+            ::new (static_cast<void*>(storage_)) Fn(std::forward<F>(f));
+            ops_ = &inline_ops<Fn>;
+        } else {
+            *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(f));
+            ops_ = &heap_ops<Fn>;
+        }
+    }
+
+    Task(Task&& other) noexcept { take(other); }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { reset(); }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+    void operator()() { ops_->invoke(storage_); }
+
+    uint64_t enqueued_ns = 0;  // Submission timestamp (lane tasks, and everything while tracing)
+
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        void (*move)(void* dst, void* src) noexcept;  // Move-construct dst, destroy src
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template<class Fn>
+    static constexpr bool fits_inline() {
+        return sizeof(Fn) <= inline_capacity && alignof(Fn) <= alignof(std::max_align_t) &&
+               std::is_nothrow_move_constructible<Fn>::value;
+    }
+
+    template<class Fn> static void invoke_inline(void* s) { (*static_cast<Fn*>(s))(); }
+    template<class Fn> static void move_inline(void* dst, void* src) noexcept {
+        ::new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+        static_cast<Fn*>(src)->~Fn();
+    }
+    template<class Fn> static void destroy_inline(void* s) noexcept { static_cast<Fn*>(s)->~Fn(); }
+
+    template<class Fn> static void invoke_heap(void* s) { (**static_cast<Fn**>(s))(); }
+    template<class Fn> static void move_heap(void* dst, void* src) noexcept {
+        *static_cast<Fn**>(dst) = *static_cast<Fn**>(src);
+    }
+    template<class Fn> static void destroy_heap(void* s) noexcept { delete *static_cast<Fn**>(s); }
+
+    template<class Fn>
+    static constexpr Ops inline_ops = { &invoke_inline<Fn>, &move_inline<Fn>, &destroy_inline<Fn> };
+    template<class Fn>
+    static constexpr Ops heap_ops = { &invoke_heap<Fn>, &move_heap<Fn>, &destroy_heap<Fn> };
+
+    void take(Task& other) noexcept {
+        enqueued_ns = other.enqueued_ns;
+        if (other.ops_) {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    void reset() noexcept {
+        if (ops_) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[inline_capacity];
+    const Ops* ops_ = nullptr;
+};
+
+// Growable FIFO ring of Tasks with a std::queue-like interface. Slots are reused,
+// so in the steady state push/pop never allocate (std::deque frees and
+// reallocates its blocks as the queue moves through them).
+class TaskQueue {
+public:
+    TaskQueue() : slots_(64), head_(0), count_(0) {}
+
+    bool empty() const { return count_ == 0; }
+    size_t size() const { return count_; }
+
+    Task& front() { return slots_[head_]; }
+
+    void push(Task&& task) {
+        if (count_ == slots_.size()) grow();
+        slots_[(head_ + count_) & (slots_.size() - 1)] = std::move(task);
+        ++count_;
+    }
+
+    void pop() {
+        slots_[head_] = Task();
+        head_ = (head_ + 1) & (slots_.size() - 1);
+        --count_;
+    }
+
+private:
+    void grow() {
+        std::vector<Task> bigger(slots_.size() * 2);
+        for (size_t i = 0; i < count_; ++i) bigger[i] = std::move(slots_[(head_ + i) & (slots_.size() - 1)]);
+        slots_.swap(bigger);
+        head_ = 0;
+    }
+
+    std::vector<Task> slots_;  // Size is always a power of two
+    size_t head_;
+    size_t count_;
+};
+
+// Monotonic timestamp used by the trace
+inline uint64_t trace_now_ns() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// One task execution as seen by a worker
+struct TraceEvent {
+    uint64_t enqueue_ns;  // When the task was submitted
+    uint64_t start_ns;    // When the worker started running it
+    uint64_t end_ns;      // When it returned
+    uint32_t worker;
+};
+
+// Fixed-size ring of TraceEvents written by exactly one worker. Recording is a
+// plain store plus a release increment: no locks, no allocation, no I/O. Once
+// full, the oldest events are overwritten. Readers see a consistent snapshot
+// when the writer is idle (e.g. after the tasks they care about have finished).
+class TraceRing {
+public:
+    explicit TraceRing(size_t capacity) : events_(new TraceEvent[round_up(capacity)]), mask_(round_up(capacity) - 1) {}
+
+    void record(const TraceEvent& event) {
+        uint64_t h = head_.load(std::memory_order_relaxed);
+        events_[h & mask_] = event;
+        head_.store(h + 1, std::memory_order_release);
+    }
+
+    // Visit the retained events, oldest first
+    template<class F>
+    void for_each(F&& visit) const {
+        uint64_t h = head_.load(std::memory_order_acquire);
+        uint64_t first = h > mask_ + 1 ? h - (mask_ + 1) : 0;
+        for (uint64_t n = first; n < h; ++n) visit(events_[n & mask_]);
+    }
+
+private:
+    static size_t round_up(size_t n) {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    std::unique_ptr<TraceEvent[]> events_;
+    uint64_t mask_;
+    alignas(64) std::atomic<uint64_t> head_{0};  // Total events ever recorded
+};
+
+// Tell the CPU we are in a spin-wait loop (saves power, frees the sibling hyperthread)
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Eventcount: lets consumers block on "some condition became true" without a
+// mutex, and lets producers skip the wake-up syscall entirely when nobody sleeps.
+//
+//   consumer: key = prepare_wait(); if (condition) cancel_wait(); else wait(key);
+//   producer: make condition true; notify_one();
+//
+// prepare_wait() registers the waiter before the condition is re-checked, and
+// notify reads the waiter count after the condition was published (both seq_cst),
+// so either the consumer sees the new state or the producer sees the waiter.
+class EventCount {
+public:
+    uint32_t prepare_wait() {
+        waiters_.fetch_add(1, std::memory_order_seq_cst);
+        return epoch_.load(std::memory_order_seq_cst);
+    }
+
+    void cancel_wait() { waiters_.fetch_sub(1, std::memory_order_seq_cst); }
+
+    // Park until a notify has happened since prepare_wait() returned `key`
+    void wait(uint32_t key) {
+        while (epoch_.load(std::memory_order_seq_cst) == key) epoch_.wait(key, std::memory_order_seq_cst);
+        waiters_.fetch_sub(1, std::memory_order_seq_cst);
+    }
+
+    void notify_one() { notify(false); }
+    void notify_all() { notify(true); }
+
+    uint32_t waiters() const { return waiters_.load(std::memory_order_seq_cst); }
+
+private:
+    void notify(bool all) {
+        if (waiters_.load(std::memory_order_seq_cst) == 0) return;  // Fast path: no syscall
+        epoch_.fetch_add(1, std::memory_order_seq_cst);
+        if (all) epoch_.notify_all(); else epoch_.notify_one();
+    }
+
+    alignas(64) std::atomic<uint32_t> epoch_{0};  // Bumped by every effective notify
+    alignas(64) std::atomic<uint32_t> waiters_{0};  // Consumers between prepare_wait and wake-up
+};
+
+// What an idle worker does before it is given more work: spin with a pause
+// instruction, then yield its time slice, then park on the pool's EventCount.
+// Spinning trades CPU time for wake-up latency under bursty load.
+struct IdlePolicy {
+    unsigned spin_iterations = 0;   // cpu_relax() rounds before yielding
+    unsigned yield_iterations = 0;  // std::this_thread::yield() rounds before parking
+
+    static IdlePolicy park() { return {0, 0}; }
+    static IdlePolicy spin_then_park(unsigned spins) { return {spins, 0}; }
+    static IdlePolicy spin_yield_park(unsigned spins, unsigned yields) { return {spins, yields}; }
+};
+
+// How the pool distributes tasks to its workers
+enum class SchedulingMode {
+    GlobalQueue,   // One shared FIFO queue behind a mutex
+    WorkStealing   // Per-worker Chase-Lev deques; idle workers steal from each other
+};
+
+// Scheduling class of a task. Each class has its own FIFO lane in the pool.
+enum class TaskPriority {
+    High,       // Latency-critical, e.g. request handlers
+    Normal,     // Default for enqueue() without a priority
+    Background  // Bulk work, e.g. compaction
+};
+
+// Set on the future of a task whose deadline passed before a worker got to it
+class DeadlineExceeded : public std::runtime_error {
+public:
+    DeadlineExceeded() : std::runtime_error("task deadline exceeded before it started") {}
+};
+
+// Snapshot of one priority lane's counters
+struct LaneStats {
+    size_t depth = 0;         // Tasks waiting in the lane right now
+    uint64_t enqueued = 0;    // Tasks ever pushed to the lane
+    uint64_t dequeued = 0;    // Tasks ever taken from the lane
+    uint64_t expired = 0;     // Tasks completed with DeadlineExceeded instead of running
+    double mean_wait_us = 0;  // Average time between push and dequeue
+    double max_wait_us = 0;
+};
+
+// Construction options for ThreadPool
+struct ThreadPoolOptions {
+    SchedulingMode mode = SchedulingMode::GlobalQueue;
+    size_t trace_capacity = 0;  // Events kept per worker; 0 disables tracing
+    IdlePolicy idle = IdlePolicy::park();  // Park immediately by default
+    unsigned starvation_limit = 16;  // A waiting lane is served after being skipped this many times
+};
+
+// Completion handle for a batch of tasks: one shared counter instead of N futures
+class BulkHandle {
+public:
+    BulkHandle() = default;
+
+    // Block until every task of the batch has finished; rethrows the first exception
+    void wait() const {
+        if (!state_) return;
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        state_->done.wait(lock, [this] { return state_->remaining.load(std::memory_order_acquire) == 0; });
+        if (state_->error) std::rethrow_exception(state_->error);
+    }
+
+    bool ready() const { return !state_ || state_->remaining.load(std::memory_order_acquire) == 0; }
+
+private:
+    friend class ThreadPool;
+
+    struct State {
+        explicit State(size_t count) : remaining(count) {}
+
+        void add(size_t count) { remaining.fetch_add(count, std::memory_order_relaxed); }
+
+        void fail(std::exception_ptr e) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) error = e;
+        }
+
+        void finish_one() {
+            if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+
+        std::atomic<size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;  // First exception thrown by any task
+    };
+
+    explicit BulkHandle(std::shared_ptr<State> state) : state_(std::move(state)) {}
+
+    std::shared_ptr<State> state_;
+};
+
+template<class T> class Future;
 
 class ThreadPool {
 public:
-    ThreadPool(size_t threads);
+    ThreadPool(size_t threads, ThreadPoolOptions options = ThreadPoolOptions());
     ~ThreadPool();
 
+    // Run every queued task, then join the workers; enqueue throws afterwards
+    void shutdown();
+
+    template<class F, class... Args>
+    auto enqueue(F&& f, Args&&... args) -> std::future<std::invoke_result_t<F, Args...>>;
+
+    // Enqueue into the lane of the given priority
     template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type>;
+    auto enqueue(TaskPriority priority, F&& f, Args&&... args) -> std::future<std::invoke_result_t<F, Args...>>;
+
+    // Like above, but if no worker has started the task by `deadline` it is not run
+    // and its future reports DeadlineExceeded
+    template<class F, class... Args>
+    auto enqueue(TaskPriority priority, std::chrono::steady_clock::time_point deadline, F&& f, Args&&... args)
+        -> std::future<std::invoke_result_t<F, Args...>>;
+
+    // Run fn(*it) for every it in [first, last); the whole batch is published at once
+    template<class It, class F>
+    BulkHandle enqueue_bulk(It first, It last, F&& fn);
+
+    // Run fn(i) for every i in [begin, end). Ranges larger than `grain` are split
+    // further while there are idle workers to hand the other half to.
+    template<class F>
+    BulkHandle parallel_for(size_t begin, size_t end, size_t grain, F&& fn);
+
+    // Write the recorded task executions in Chrome trace format (chrome://tracing, Perfetto).
+    // Workers record without locks, so call it after shutdown().
+    void export_chrome_trace(std::ostream& out) const;
+
+    LaneStats lane_stats(TaskPriority priority) const;
+
+    // Fire-and-forget: run fn() on the pool without creating a future
+    template<class F>
+    void post(F&& fn, TaskPriority priority = TaskPriority::Normal) {
+        push_task(Task(std::forward<F>(fn)), priority);
+    }
+
+    // Run fn() on the pool; the result can be composed with then/when_all/when_any
+    template<class F>
+    auto submit(F&& fn, TaskPriority priority = TaskPriority::Normal) -> Future<std::invoke_result_t<F>>;
 
 private:
+    template<class Fn> struct ParallelForChunk;
+
+    static constexpr size_t lane_count = 3;
+
+    // Counters of one lane, guarded by queue_mutex (except `expired`)
+    struct LaneCounters {
+        uint64_t enqueued = 0;
+        uint64_t dequeued = 0;
+        uint64_t total_wait_ns = 0;
+        uint64_t max_wait_ns = 0;
+        unsigned skipped = 0;  // Times passed over for a higher lane since last served
+        std::atomic<uint64_t> expired{0};
+    };
+
+    template<class R, class Fn, class Tuple>
+    static void fulfil(std::promise<R>& promise, Fn& fn, Tuple& bound);
+
+    void worker_loop(size_t index);
+    void push_task(Task task, TaskPriority priority = TaskPriority::Normal);  // Route a task to the right queue
+    template<class MakeTask>
+    void push_batch(size_t count, MakeTask&& make_task,  // Publish make_task(0..count-1) at once
+                    TaskPriority priority = TaskPriority::Normal);
+    bool pop_lanes(Task& task);  // Take the next task from the lanes; queue_mutex must be held
+    void wake_workers(size_t count);  // Wake up to `count` parked workers, if there are any
+    bool has_idle_workers() const { return idle_workers.load(std::memory_order_relaxed) > 0; }
+    bool try_pop(size_t index, Task& task);
+    bool try_pop_work_stealing(size_t index, Task& task);  // Own deque -> global queue -> steal
+    void idle_wait();  // Spin, yield, then park according to options.idle
+
     std::vector<std::thread> workers;  // Worker threads
-    std::queue<std::function<void()>> tasks;  // Task queue
+    TaskQueue lanes[lane_count];  // Task queues, one per priority (injection queues in work-stealing mode)
+    LaneCounters lane_counters[lane_count];
+
+    mutable std::mutex queue_mutex;  // Mutex for the lanes
+    EventCount idle_event;  // Parked workers wait here for new tasks
+    std::atomic<bool> stop;  // Stopping flag
+
+    ThreadPoolOptions options;
+    std::shared_ptr<SlabAllocator> slab;  // Task nodes and promise/future shared state
+    std::vector<std::unique_ptr<WorkStealingDeque<Task*>>> deques;  // One deque per worker (nodes from slab)
+    std::atomic<size_t> pending{0};  // Tasks queued anywhere, published after the push
+    std::atomic<size_t> idle_workers{0};  // Workers currently spinning, yielding or parked
+    std::atomic<size_t> urgent{0};  // Tasks in the High lane; work-stealing workers check it first
+    std::atomic<size_t> queued{0};  // Tasks in all lanes; work-stealing workers skip the lock while it is 0
 
-    std::mutex queue_mutex;  // Mutex for task queue
-    std::condition_variable condition;  // Condition variable for task queue
-    bool stop;  // Stopping flag
+    // Identifies the pool and worker index of the calling thread, if any
+    static thread_local ThreadPool* current_pool;
+    static thread_local size_t current_index;
 
-    // Mutex for synchronizing console output
-    std::mutex print_mutex;
+    std::vector<std::unique_ptr<TraceRing>> traces;  // One per worker when tracing is enabled
 };
 
+thread_local ThreadPool* ThreadPool::current_pool = nullptr;
+thread_local size_t ThreadPool::current_index = 0;
+
 // Constructor: Initialize worker threads
-ThreadPool::ThreadPool(size_t threads) : stop(false) {
+ThreadPool::ThreadPool(size_t threads, ThreadPoolOptions options)
+    : stop(false), options(options), slab(std::make_shared<SlabAllocator>()) {
+    if (options.mode == SchedulingMode::WorkStealing) {
+        for (size_t i = 0; i < threads; ++i) deques.emplace_back(new WorkStealingDeque<Task*>());
+    }
+    if (options.trace_capacity > 0) {
+        for (size_t i = 0; i < threads; ++i) traces.emplace_back(new TraceRing(options.trace_capacity));
+    }
     for (size_t i = 0; i < threads; ++i) {
-        workers.emplace_back([this, i] {
-            for (;;) {
-                std::function<void()> task;
+        workers.emplace_back([this, i] { worker_loop(i); });
+    }
+}
+
+// Destructor: Join all worker threads
+ThreadPool::~ThreadPool() {
+    shutdown();
+}
 
-                {  // Acquire lock
-                    std::unique_lock<std::mutex> lock(this->queue_mutex);
-                    this->condition.wait(lock, [this] { return this->stop || !this->tasks.empty(); });
+void ThreadPool::shutdown() {
+    {  // Acquire lock
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        stop.store(true, std::memory_order_seq_cst);
+    }  // Release lock
 
-                    if (this->stop && this->tasks.empty()) return;
+    // Unconditional: a worker may be between its last check and parking
+    idle_event.notify_all();
+    for (std::thread &worker : workers) {
+        if (worker.joinable()) worker.join();
+    }
+}
 
-                    task = std::move(this->tasks.front());
-                    this->tasks.pop();
-                }  // Release lock
+// Main loop of worker thread `i`
+void ThreadPool::worker_loop(size_t i) {
+    current_pool = this;
+    current_index = i;
 
-                {
-                    // Lock for printing
-                    std::lock_guard<std::mutex> lock(this->print_mutex);
-                    std::cout << "Thread " << i << " executing task." << std::endl;
-                }
-                task();
-                {
-                    // Lock for printing
-                    std::lock_guard<std::mutex> lock(this->print_mutex);
-                    std::cout << "Thread " << i << " finished task." << std::endl;
-                }
-            }
-        });
+    for (;;) {
+        Task task;
+
+        if (!try_pop(i, task)) {
+            if (stop.load(std::memory_order_seq_cst) && pending.load(std::memory_order_seq_cst) == 0) return;
+            idle_wait();
+            continue;
+        }
+
+        if (traces.empty()) {
+            task();
+        } else {
+            uint64_t start = trace_now_ns();
+            task();
+            traces[i]->record({task.enqueued_ns, start, trace_now_ns(), static_cast<uint32_t>(i)});
+        }
     }
 }
 
-// Destructor: Join all worker threads
-ThreadPool::~ThreadPool() {
+// Wait until there is probably work (or we are stopping)
+void ThreadPool::idle_wait() {
+    auto has_work = [this] {
+        return pending.load(std::memory_order_seq_cst) > 0 || stop.load(std::memory_order_seq_cst);
+    };
+
+    idle_workers.fetch_add(1, std::memory_order_relaxed);
+    bool woken = false;
+    for (unsigned n = 0; n < options.idle.spin_iterations && !woken; ++n) {
+        if (has_work()) woken = true; else cpu_relax();
+    }
+    for (unsigned n = 0; n < options.idle.yield_iterations && !woken; ++n) {
+        if (has_work()) woken = true; else std::this_thread::yield();
+    }
+    if (!woken) {
+        uint32_t key = idle_event.prepare_wait();
+        if (has_work()) idle_event.cancel_wait(); else idle_event.wait(key);
+    }
+    idle_workers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Find a task for worker `i`
+bool ThreadPool::try_pop(size_t i, Task& task) {
+    if (options.mode == SchedulingMode::WorkStealing) return try_pop_work_stealing(i, task);
+
+    if (pending.load(std::memory_order_acquire) == 0) return false;  // Don't take the lock for nothing
+
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    return pop_lanes(task);
+}
+
+// Strict priority order, except that a non-empty lane skipped `starvation_limit`
+// times in a row is served next, so background work always makes progress
+bool ThreadPool::pop_lanes(Task& task) {
+    size_t chosen = lane_count;
+    for (size_t l = lane_count; l-- > 1;) {
+        if (!lanes[l].empty() && lane_counters[l].skipped >= options.starvation_limit) {
+            chosen = l;
+            break;
+        }
+    }
+    if (chosen == lane_count) {
+        for (size_t l = 0; l < lane_count && chosen == lane_count; ++l) {
+            if (!lanes[l].empty()) chosen = l;
+        }
+    }
+    if (chosen == lane_count) return false;
+
+    for (size_t l = chosen + 1; l < lane_count; ++l) {
+        if (!lanes[l].empty()) ++lane_counters[l].skipped;
+    }
+
+    task = std::move(lanes[chosen].front());
+    lanes[chosen].pop();
+    pending.fetch_sub(1, std::memory_order_relaxed);
+    queued.fetch_sub(1, std::memory_order_relaxed);
+    if (chosen == static_cast<size_t>(TaskPriority::High)) urgent.fetch_sub(1, std::memory_order_relaxed);
+
+    LaneCounters& counters = lane_counters[chosen];
+    uint64_t wait = trace_now_ns() - task.enqueued_ns;
+    counters.skipped = 0;
+    ++counters.dequeued;
+    counters.total_wait_ns += wait;
+    counters.max_wait_ns = std::max(counters.max_wait_ns, wait);
+    return true;
+}
+
+LaneStats ThreadPool::lane_stats(TaskPriority priority) const {
+    size_t l = static_cast<size_t>(priority);
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    const LaneCounters& counters = lane_counters[l];
+
+    LaneStats stats;
+    stats.depth = lanes[l].size();
+    stats.enqueued = counters.enqueued;
+    stats.dequeued = counters.dequeued;
+    stats.expired = counters.expired.load(std::memory_order_relaxed);
+    stats.mean_wait_us = counters.dequeued ? counters.total_wait_ns / 1000.0 / counters.dequeued : 0.0;
+    stats.max_wait_us = counters.max_wait_ns / 1000.0;
+    return stats;
+}
+
+// Find a task for worker `i` in work-stealing mode
+bool ThreadPool::try_pop_work_stealing(size_t i, Task& task) {
+    Task* stolen = nullptr;
+
+    // 0. High-priority tasks jump ahead of local work
+    if (urgent.load(std::memory_order_relaxed) > 0) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (pop_lanes(task)) return true;
+    }
+
+    // 1. Our own deque, newest first
+    if (deques[i]->pop(stolen)) {
+        pending.fetch_sub(1, std::memory_order_relaxed);
+        task = std::move(*stolen);
+        stolen->~Task();
+        slab->deallocate(stolen, sizeof(Task));
+        return true;
+    }
+
+    // 2. Tasks submitted from outside the pool, or with an explicit priority
+    if (queued.load(std::memory_order_acquire) > 0) {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if (pop_lanes(task)) return true;
+    }
+
+    // 3. Steal the oldest task of another worker, starting after ourselves
+    for (size_t k = 1; k < deques.size(); ++k) {
+        size_t victim = (i + k) % deques.size();
+        if (deques[victim]->steal(stolen)) {
+            pending.fetch_sub(1, std::memory_order_relaxed);
+            task = std::move(*stolen);
+            stolen->~Task();
+            slab->deallocate(stolen, sizeof(Task));
+            return true;
+        }
+    }
+    return false;
+}
+
+// Put a task where a worker will find it
+void ThreadPool::push_task(Task task, TaskPriority priority) {
+    push_batch(1, [&task](size_t) { return std::move(task); }, priority);
+}
+
+// Publish `count` tasks with a single lock acquisition (or, from inside a
+// work-stealing worker, with no lock at all) and a single round of wake-ups
+template<class MakeTask>
+void ThreadPool::push_batch(size_t count, MakeTask&& make_task, TaskPriority priority) {
+    if (count == 0) return;
+    bool local = options.mode == SchedulingMode::WorkStealing && current_pool == this &&
+                 priority == TaskPriority::Normal;
+
+    // Lane tasks are always stamped for the wait counters; local ones only for the trace
+    uint64_t now = (!local || !traces.empty()) ? trace_now_ns() : 0;
+    auto make_traced = [&](size_t k) {
+        Task task = make_task(k);
+        task.enqueued_ns = now;
+        return task;
+    };
+
+    if (local) {
+        // Normal-priority task submitted from one of our workers: keep it on that worker's deque.
+        // Workers drain their deques before exiting, so this is safe during shutdown.
+        WorkStealingDeque<Task*>& deque = *deques[current_index];
+        for (size_t k = 0; k < count; ++k) {
+            deque.push(::new (slab->allocate(sizeof(Task))) Task(make_traced(k)));
+        }
+        pending.fetch_add(count, std::memory_order_seq_cst);
+        wake_workers(count);
+        return;
+    }
+
     {  // Acquire lock
         std::unique_lock<std::mutex> lock(queue_mutex);
-        stop = true;
+
+        if (stop.load(std::memory_order_relaxed)) throw std::runtime_error("enqueue on stopped ThreadPool");
+
+        size_t l = static_cast<size_t>(priority);
+        for (size_t k = 0; k < count; ++k) lanes[l].push(make_traced(k));
+        lane_counters[l].enqueued += count;
+        if (priority == TaskPriority::High) urgent.fetch_add(count, std::memory_order_relaxed);
+        queued.fetch_add(count, std::memory_order_release);
+        pending.fetch_add(count, std::memory_order_seq_cst);
     }  // Release lock
 
-    condition.notify_all();  // Notify all threads
-    for (std::thread &worker : workers) worker.join();
+    wake_workers(count);
+}
+
+// The EventCount makes this free when every worker is busy or still spinning
+void ThreadPool::wake_workers(size_t count) {
+    if (count == 1) idle_event.notify_one(); else idle_event.notify_all();
+}
+
+// Run a bound call and store its result (or exception) in the promise
+template<class R, class Fn, class Tuple>
+void ThreadPool::fulfil(std::promise<R>& promise, Fn& fn, Tuple& bound) {
+    try {
+        if constexpr (std::is_void<R>::value) {
+            std::apply(fn, std::move(bound));
+            promise.set_value();
+        } else {
+            promise.set_value(std::apply(fn, std::move(bound)));
+        }
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+    }
 }
 
 // Add new work item to the pool
 template<class F, class... Args>
-auto ThreadPool::enqueue(F&& f, Args&&... args) -> std::future<typename std::result_of<F(Args...)>::type> {
-    using return_type = typename std::result_of<F(Args...)>::type;
+auto ThreadPool::enqueue(F&& f, Args&&... args) -> std::future<std::invoke_result_t<F, Args...>> {
+    return enqueue(TaskPriority::Normal, std::forward<F>(f), std::forward<Args>(args)...);
+}
 
-    auto task = std::make_shared<std::packaged_task<return_type()>>(
-        std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-    );
+template<class F, class... Args>
+auto ThreadPool::enqueue(TaskPriority priority, F&& f, Args&&... args)
+    -> std::future<std::invoke_result_t<F, Args...>> {
+    using return_type = std::invoke_result_t<F, Args...>;
 
-    std::future<return_type> res = task->get_future();
+    // The promise's shared state comes from the slab, and the callable, its bound
+    // arguments and the promise all fit inside the Task's inline storage.
+    std::promise<return_type> promise(std::allocator_arg, SlabStdAllocator<return_type>(slab));
+    std::future<return_type> res = promise.get_future();
 
-    {  // Acquire lock
-        std::unique_lock<std::mutex> lock(queue_mutex);
+    push_task([promise = std::move(promise), fn = std::forward<F>(f),
+               bound = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        fulfil(promise, fn, bound);
+    }, priority);
+    return res;
+}
 
-        if (stop) throw std::runtime_error("enqueue on stopped ThreadPool");
+template<class F, class... Args>
+auto ThreadPool::enqueue(TaskPriority priority, std::chrono::steady_clock::time_point deadline, F&& f, Args&&... args)
+    -> std::future<std::invoke_result_t<F, Args...>> {
+    using return_type = std::invoke_result_t<F, Args...>;
 
-        tasks.emplace([task]() { (*task)(); });
-    }  // Release lock
+    std::promise<return_type> promise(std::allocator_arg, SlabStdAllocator<return_type>(slab));
+    std::future<return_type> res = promise.get_future();
 
-    condition.notify_one();
+    std::atomic<uint64_t>* expired = &lane_counters[static_cast<size_t>(priority)].expired;
+    push_task([expired, deadline, promise = std::move(promise), fn = std::forward<F>(f),
+               bound = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+        if (std::chrono::steady_clock::now() > deadline) {
+            expired->fetch_add(1, std::memory_order_relaxed);
+            promise.set_exception(std::make_exception_ptr(DeadlineExceeded()));
+            return;
+        }
+        fulfil(promise, fn, bound);
+    }, priority);
     return res;
 }
 
-// Example function to run as a task
-void example_function(int n, std::mutex &print_mutex) {
-    {
-        // Lock for printing
-        std::lock_guard<std::mutex> lock(print_mutex);
-        std::cout << "Task " << n << " is running." << std::endl;
+void ThreadPool::export_chrome_trace(std::ostream& out) const {
+    // Timestamps are relative to the earliest submission so the viewer starts at zero
+    uint64_t origin = UINT64_MAX;
+    for (const auto& ring : traces) {
+        ring->for_each([&origin](const TraceEvent& e) { origin = std::min(origin, e.enqueue_ns); });
+    }
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    for (const auto& ring : traces) {
+        ring->for_each([&](const TraceEvent& e) {
+            out << (first ? "\n" : ",\n");
+            first = false;
+            out << "{\"name\":\"task\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.worker
+                << ",\"ts\":" << (e.start_ns - origin) / 1000.0
+                << ",\"dur\":" << (e.end_ns - e.start_ns) / 1000.0
+                << ",\"args\":{\"queue_wait_us\":" << (e.start_ns - e.enqueue_ns) / 1000.0 << "}}";
+        });
+    }
+    out << "\n],\"displayTimeUnit\":\"ns\"}\n";
+    out.flags(flags);
+    out.precision(precision);
+}
+
+// Add a batch of work items, one per element of [first, last)
+template<class It, class F>
+BulkHandle ThreadPool::enqueue_bulk(It first, It last, F&& fn) {
+    using Fn = typename std::decay<F>::type;
+    size_t count = static_cast<size_t>(std::distance(first, last));
+    auto state = std::make_shared<BulkHandle::State>(count);
+    auto shared_fn = std::make_shared<Fn>(std::forward<F>(fn));
+
+    It it = first;
+    push_batch(count, [&](size_t) {
+        It current = it++;
+        return Task([state, shared_fn, current] {
+            try {
+                (*shared_fn)(*current);
+            } catch (...) {
+                state->fail(std::current_exception());
+            }
+            state->finish_one();
+        });
+    });
+    return BulkHandle(std::move(state));
+}
+
+// One chunk of a parallel_for. Before running its range it hands the upper half
+// to the pool for as long as the range is above the grain and workers are idle
+// (lazy binary splitting), so the split adapts to the actual load.
+template<class Fn>
+struct ThreadPool::ParallelForChunk {
+    void operator()() {
+        try {
+            while (end - begin > grain && pool->has_idle_workers()) {
+                size_t mid = begin + (end - begin) / 2;
+                state->add(1);
+                try {
+                    pool->push_task(ParallelForChunk{pool, state, fn, mid, end, grain});
+                } catch (...) {
+                    state->finish_one();  // The child was never queued
+                    throw;
+                }
+                end = mid;
+            }
+            for (size_t i = begin; i < end; ++i) (*fn)(i);
+        } catch (...) {
+            state->fail(std::current_exception());
+        }
+        state->finish_one();
+    }
+
+    ThreadPool* pool;
+    std::shared_ptr<BulkHandle::State> state;
+    std::shared_ptr<Fn> fn;
+    size_t begin, end, grain;
+};
+
+// Add a loop over [begin, end), initially cut into one chunk per worker
+template<class F>
+BulkHandle ThreadPool::parallel_for(size_t begin, size_t end, size_t grain, F&& fn) {
+    using Fn = typename std::decay<F>::type;
+    if (grain == 0) grain = 1;
+    size_t total = end > begin ? end - begin : 0;
+    size_t chunks = std::min(workers.size(), (total + grain - 1) / grain);
+    auto state = std::make_shared<BulkHandle::State>(chunks);
+    auto shared_fn = std::make_shared<Fn>(std::forward<F>(fn));
+
+    push_batch(chunks, [&](size_t k) {
+        size_t first = begin + total * k / chunks;
+        size_t last = begin + total * (k + 1) / chunks;
+        return Task(ParallelForChunk<Fn>{this, state, shared_fn, first, last, grain});
+    });
+    return BulkHandle(std::move(state));
+}
+
+// Value type used for Future<void> internally
+struct Unit {};
+template<class T> using ValueOf = std::conditional_t<std::is_void_v<T>, Unit, T>;
+
+// Shared state of a Future/Promise pair. All synchronization goes through one
+// atomic word that is either EMPTY, READY, WAITING (a thread is blocked in
+// wait()) or a pointer to the single continuation to run on completion.
+template<class T>
+class FutureState {
+public:
+    FutureState() = default;
+    FutureState(const FutureState&) = delete;
+    FutureState& operator=(const FutureState&) = delete;
+
+    ~FutureState() {
+        uintptr_t s = state_.load(std::memory_order_relaxed);
+        if (s != EMPTY && s != READY && s != WAITING) delete reinterpret_cast<Task*>(s);
+    }
+
+    void set_value(ValueOf<T> value) {
+        value_.emplace(std::move(value));
+        publish();
+    }
+
+    void set_exception(std::exception_ptr error) {
+        error_ = error;
+        publish();
+    }
+
+    bool ready() const { return state_.load(std::memory_order_acquire) == READY; }
+
+    // Block the calling thread until the result is available
+    void wait() {
+        uintptr_t s = state_.load(std::memory_order_acquire);
+        if (s == EMPTY && state_.compare_exchange_strong(s, WAITING, std::memory_order_acq_rel)) s = WAITING;
+        while (s != READY) {
+            state_.wait(s, std::memory_order_acquire);
+            s = state_.load(std::memory_order_acquire);
+        }
+    }
+
+    // Run `continuation` once the result is available: right away if it already
+    // is, otherwise on the thread that completes the promise
+    void subscribe(Task* continuation) {
+        uintptr_t expected = EMPTY;
+        if (state_.compare_exchange_strong(expected, reinterpret_cast<uintptr_t>(continuation),
+                                           std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return;
+        }
+        run(continuation);  // Already READY
+    }
+
+    // Only valid once ready
+    bool has_error() const { return error_ != nullptr; }
+    std::exception_ptr error() const { return error_; }
+    ValueOf<T>& value() {
+        if (error_) std::rethrow_exception(error_);
+        return *value_;
+    }
+
+private:
+    static constexpr uintptr_t EMPTY = 0;
+    static constexpr uintptr_t READY = 1;
+    static constexpr uintptr_t WAITING = 2;  // Task pointers are 16-byte aligned, so never 1 or 2
+
+    void publish() {
+        uintptr_t old = state_.exchange(READY, std::memory_order_acq_rel);
+        if (old == WAITING) {
+            state_.notify_all();
+        } else if (old != EMPTY) {
+            run(reinterpret_cast<Task*>(old));
+        }
+    }
+
+    static void run(Task* continuation) {
+        (*continuation)();
+        delete continuation;
+    }
+
+    std::atomic<uintptr_t> state_{EMPTY};
+    std::optional<ValueOf<T>> value_;
+    std::exception_ptr error_;
+};
+
+template<class T> class Future;
+
+// Producer side of a Future. Destroying an unfulfilled Promise breaks it.
+template<class T>
+class Promise {
+public:
+    Promise() : state_(std::make_shared<FutureState<T>>()) {}
+    Promise(Promise&&) noexcept = default;
+    Promise& operator=(Promise&&) noexcept = default;
+
+    ~Promise() {
+        if (state_ && !fulfilled_) {
+            state_->set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+
+    Future<T> get_future() { return Future<T>(state_); }
+
+    template<class U = T, class = std::enable_if_t<!std::is_void_v<U>>>
+    void set_value(U value) {
+        fulfilled_ = true;
+        state_->set_value(std::move(value));
     }
+
+    template<class U = T, class = std::enable_if_t<std::is_void_v<U>>>
+    void set_value() {
+        fulfilled_ = true;
+        state_->set_value(Unit());
+    }
+
+    void set_exception(std::exception_ptr error) {
+        fulfilled_ = true;
+        state_->set_exception(error);
+    }
+
+private:
+    std::shared_ptr<FutureState<T>> state_;
+    bool fulfilled_ = false;
+};
+
+// Consumer side: like std::future, but results can be consumed with a
+// continuation instead of a blocked thread
+template<class T>
+class Future {
+public:
+    Future() = default;
+
+    bool valid() const { return state_ != nullptr; }
+    bool ready() const { return state_->ready(); }
+    void wait() const { state_->wait(); }
+
+    // Blocking access, for the edges of a program
+    T get() {
+        state_->wait();
+        auto state = std::move(state_);
+        if constexpr (std::is_void_v<T>) {
+            state->value();
+        } else {
+            return std::move(state->value());
+        }
+    }
+
+    // Run fn(value) (or fn() for Future<void>) on the thread that completes this
+    // future, or right here if it already has. Exceptions skip fn and propagate.
+    template<class F>
+    auto then(F&& fn) { return then_on(nullptr, std::forward<F>(fn)); }
+
+    // Same, but fn runs as a task on `pool`
+    template<class F>
+    auto then(ThreadPool& pool, F&& fn) { return then_on(&pool, std::forward<F>(fn)); }
+
+private:
+    template<class U> friend class Promise;
+    template<class U> friend class Future;
+    template<class U> friend Future<std::conditional_t<std::is_void_v<U>, void, std::vector<U>>> when_all(std::vector<Future<U>>);
+    template<class U> friend auto when_any(std::vector<Future<U>>);
+
+    explicit Future(std::shared_ptr<FutureState<T>> state) : state_(std::move(state)) {}
+
+    template<class F>
+    static auto call(F& fn, FutureState<T>& state) {
+        if constexpr (std::is_void_v<T>) return fn(); else return fn(std::move(state.value()));
+    }
+
+    template<class F>
+    auto then_on(ThreadPool* pool, F&& fn);
+
+    // Low-level hook: on_ready(state) runs once the result (or error) is set
+    template<class F>
+    void subscribe(F&& on_ready) {
+        auto state = std::move(state_);
+        FutureState<T>* raw = state.get();
+        raw->subscribe(new Task([state = std::move(state), on_ready = std::forward<F>(on_ready)]() mutable {
+            on_ready(*state);
+        }));
+    }
+
+    std::shared_ptr<FutureState<T>> state_;
+};
+
+// Store the result of calling `fn` in `promise`
+template<class R, class F>
+void fulfil_with(Promise<R>& promise, F&& fn) {
+    try {
+        if constexpr (std::is_void_v<R>) {
+            fn();
+            promise.set_value();
+        } else {
+            promise.set_value(fn());
+        }
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+}
+
+template<class T>
+template<class F>
+auto Future<T>::then_on(ThreadPool* pool, F&& fn) {
+    using Fn = std::decay_t<F>;
+    using R = decltype(call(std::declval<Fn&>(), std::declval<FutureState<T>&>()));
+
+    Promise<R> next;
+    Future<R> result = next.get_future();
+    subscribe([pool, fn = Fn(std::forward<F>(fn)), next = std::move(next)](FutureState<T>& state) mutable {
+        if (state.has_error()) {
+            next.set_exception(state.error());
+            return;
+        }
+        if (!pool) {
+            fulfil_with(next, [&] { return call(fn, state); });
+            return;
+        }
+        // The pool task needs its own reference to the value, so move it out now
+        pool->post([fn = std::move(fn), next = std::move(next), value = std::move(state.value())]() mutable {
+            fulfil_with(next, [&]() -> R {
+                if constexpr (std::is_void_v<T>) return fn(); else return fn(std::move(value));
+            });
+        });
+    });
+    return result;
+}
+
+// Completes when every input has completed. The value is the inputs' values in
+// order (nothing for Future<void>); the first error wins.
+template<class T>
+Future<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> when_all(std::vector<Future<T>> inputs) {
+    using R = std::conditional_t<std::is_void_v<T>, void, std::vector<T>>;
+
+    struct Join {
+        explicit Join(size_t n) : values(n), remaining(n) {}
+        std::vector<std::optional<ValueOf<T>>> values;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed{false};
+        Promise<R> promise;
+    };
+
+    auto join = std::make_shared<Join>(inputs.size());
+    Future<R> result = join->promise.get_future();
+    if (inputs.empty()) {
+        if constexpr (std::is_void_v<T>) join->promise.set_value(); else join->promise.set_value({});
+        return result;
+    }
+
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        inputs[i].subscribe([join, i](FutureState<T>& state) {
+            if (state.has_error()) {
+                if (!join->failed.exchange(true, std::memory_order_acq_rel)) join->promise.set_exception(state.error());
+            } else {
+                join->values[i].emplace(std::move(state.value()));
+            }
+            if (join->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            if (join->failed.load(std::memory_order_acquire)) return;
+            if constexpr (std::is_void_v<T>) {
+                join->promise.set_value();
+            } else {
+                std::vector<T> values;
+                values.reserve(join->values.size());
+                for (auto& v : join->values) values.push_back(std::move(*v));
+                join->promise.set_value(std::move(values));
+            }
+        });
+    }
+    return result;
+}
+
+// Which input of a when_any completed first, and with what value
+template<class T>
+struct WhenAnyResult {
+    size_t index;
+    ValueOf<T> value;
+};
+
+// Completes with the first input to complete (including with an error)
+template<class T>
+auto when_any(std::vector<Future<T>> inputs) {
+    struct Race {
+        std::atomic<bool> decided{false};
+        Promise<WhenAnyResult<T>> promise;
+    };
+
+    auto race = std::make_shared<Race>();
+    Future<WhenAnyResult<T>> result = race->promise.get_future();
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        inputs[i].subscribe([race, i](FutureState<T>& state) {
+            if (race->decided.exchange(true, std::memory_order_acq_rel)) return;
+            if (state.has_error()) {
+                race->promise.set_exception(state.error());
+            } else {
+                race->promise.set_value(WhenAnyResult<T>{i, std::move(state.value())});
+            }
+        });
+    }
+    return result;
+}
+
+// Run fn() on the pool and get a continuation-capable Future for its result
+template<class F>
+auto ThreadPool::submit(F&& fn, TaskPriority priority) -> Future<std::invoke_result_t<F>> {
+    using R = std::invoke_result_t<F>;
+    Promise<R> promise;
+    Future<R> result = promise.get_future();
+    post([promise = std::move(promise), fn = std::forward<F>(fn)]() mutable { fulfil_with(promise, fn); },
+         priority);
+    return result;
+}
+
+// Example function to run as a task. Workers log through the async logger:
+// no console lock is held while a task runs.
+void example_function(int n) {
+    alog::info("Task ", n, " is running.");
     std::this_thread::sleep_for(std::chrono::seconds(1)); // Simulate work
-    {
-        // Lock for printing
-        std::lock_guard<std::mutex> lock(print_mutex);
-        std::cout << "Task " << n << " is finished." << std::endl;
+    alog::info("Task ", n, " is finished.");
+}
+
+// Benchmark: nested fan-out where every task spawns children from inside the pool.
+// This is the pattern work stealing is designed for.
+double bench_nested(size_t threads, SchedulingMode mode, int roots, int children) {
+    ThreadPoolOptions options;
+    options.mode = mode;
+    ThreadPool pool(threads, options);
+
+    std::atomic<long> remaining(static_cast<long>(roots) * (children + 1));
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < roots; ++r) {
+        pool.enqueue([&pool, &remaining, children] {
+            for (int c = 0; c < children; ++c) {
+                pool.enqueue([&remaining] { remaining.fetch_sub(1, std::memory_order_relaxed); });
+            }
+            remaining.fetch_sub(1, std::memory_order_relaxed);
+        });
+    }
+    while (remaining.load(std::memory_order_relaxed) > 0) std::this_thread::yield();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+// Benchmark: many tiny tasks submitted from the main thread
+double bench_flat(size_t threads, SchedulingMode mode, int count) {
+    ThreadPoolOptions options;
+    options.mode = mode;
+    ThreadPool pool(threads, options);
+
+    std::atomic<long> remaining(count);
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < count; ++n) {
+        pool.enqueue([&remaining] { remaining.fetch_sub(1, std::memory_order_relaxed); });
     }
+    while (remaining.load(std::memory_order_relaxed) > 0) std::this_thread::yield();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
 }
 
-int main() {
-    // Create a thread pool with 4 threads
-    ThreadPool pool(4);
+// Benchmark: 1M loop iterations submitted as one enqueue per iteration (like main),
+// as one enqueue_bulk batch, and as a parallel_for
+void run_bulk_benchmark(SchedulingMode mode) {
+    const size_t iterations = 1000000;
+    ThreadPoolOptions options;
+    options.mode = mode;
+    ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()), options);
 
-    // Mutex for synchronizing console output in tasks
-    std::mutex print_mutex;
+    std::vector<double> data(iterations, 1.0);
+    auto body = [&data](size_t i) { data[i] = data[i] * 1.0001 + 0.5; };
+    auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::future<void>> results;
+    results.reserve(iterations);
+    for (size_t i = 0; i < iterations; ++i) results.emplace_back(pool.enqueue(body, i));
+    for (auto &&result : results) result.get();
+    double per_task = seconds_since(start);
+
+    std::vector<size_t> indices(iterations);
+    for (size_t i = 0; i < iterations; ++i) indices[i] = i;
+    start = std::chrono::steady_clock::now();
+    pool.enqueue_bulk(indices.begin(), indices.end(), body).wait();
+    double bulk = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    pool.parallel_for(0, iterations, 4096, body).wait();
+    double range = seconds_since(start);
+
+    std::printf("%-13s  enqueue loop %8.3f s  enqueue_bulk %8.3f s  parallel_for %8.3f s\n",
+                mode == SchedulingMode::GlobalQueue ? "global queue" : "work stealing",
+                per_task, bulk, range);
+}
+
+// Benchmark: enqueue-to-start latency under bursty load. Each burst is followed by
+// a pause long enough for the workers to go idle (and, with parking, to sleep).
+void run_idle_policy_benchmark(const char* name, IdlePolicy idle) {
+    const int bursts = 200, burst_size = 16;
+    ThreadPoolOptions options;
+    options.idle = idle;
+    ThreadPool pool(std::max(2u, std::thread::hardware_concurrency()), options);
+
+    std::vector<uint64_t> latencies(bursts * burst_size);
+    std::atomic<size_t> finished(0);
+    for (int b = 0; b < bursts; ++b) {
+        for (int n = 0; n < burst_size; ++n) {
+            size_t slot = b * burst_size + n;
+            uint64_t enqueued = trace_now_ns();
+            pool.enqueue([&latencies, &finished, slot, enqueued] {
+                latencies[slot] = trace_now_ns() - enqueued;
+                finished.fetch_add(1, std::memory_order_release);
+            });
+        }
+        while (finished.load(std::memory_order_acquire) < size_t(b + 1) * burst_size) std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) { return latencies[size_t(p * (latencies.size() - 1))] / 1000.0; };
+    std::printf("%-18s  p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", name,
+                percentile(0.50), percentile(0.99), latencies.back() / 1000.0);
+}
+
+// Burn CPU for roughly `us` microseconds
+void busy_work(uint64_t us) {
+    uint64_t until = trace_now_ns() + us * 1000;
+    while (trace_now_ns() < until) cpu_relax();
+}
+
+// Benchmark: latency of short "request" tasks while the pool is flooded with
+// background batches, with everything in one FIFO lane vs separate lanes
+void run_priority_benchmark(bool use_lanes) {
+    const int background = 4000, requests = 200;
+    ThreadPool pool(2);
+
+    TaskPriority bulk_lane = use_lanes ? TaskPriority::Background : TaskPriority::Normal;
+    TaskPriority request_lane = use_lanes ? TaskPriority::High : TaskPriority::Normal;
+    std::vector<std::future<void>> bulk;
+    bulk.reserve(background);
+    for (int n = 0; n < background; ++n) bulk.emplace_back(pool.enqueue(bulk_lane, busy_work, 20));
+
+    std::vector<uint64_t> latencies;
+    std::vector<std::future<uint64_t>> results;
+    for (int r = 0; r < requests; ++r) {
+        uint64_t enqueued = trace_now_ns();
+        results.emplace_back(pool.enqueue(request_lane, [enqueued] { return trace_now_ns() - enqueued; }));
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    for (auto &&result : results) latencies.push_back(result.get());
+    for (auto &&result : bulk) result.get();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("%-24s  request p50 %9.1f us  p99 %9.1f us   background mean wait %9.1f us\n",
+                use_lanes ? "High/Background lanes" : "single FIFO lane",
+                latencies[latencies.size() / 2] / 1000.0, latencies[latencies.size() * 99 / 100] / 1000.0,
+                pool.lane_stats(bulk_lane).mean_wait_us);
+}
+
+// Small amount of CPU work for the DAG nodes
+long leaf_work(long seed) {
+    long x = seed;
+    for (int n = 0; n < 1000; ++n) x = x * 6364136223846793005L + 1442695040888963407L;
+    return x & 0xff;
+}
+
+// Benchmark: many independent fan-out/fan-in DAGs (width leaves -> one join).
+// std::async needs a thread per node and blocks the join's thread in get();
+// Future composes the join as a continuation on the pool.
+void run_dag_benchmark(int dags, int width) {
+    auto seconds_since = [](std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::future<long>> joins;
+    for (int d = 0; d < dags; ++d) {
+        std::vector<std::future<long>> leaves;
+        for (int w = 0; w < width; ++w) leaves.push_back(std::async(std::launch::async, leaf_work, d * width + w));
+        joins.push_back(std::async(std::launch::async, [leaves = std::move(leaves)]() mutable {
+            long sum = 0;
+            for (auto &&leaf : leaves) sum += leaf.get();
+            return sum;
+        }));
+    }
+    long std_total = 0;
+    for (auto &&join : joins) std_total += join.get();
+    double std_time = seconds_since(start);
+
+    ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    start = std::chrono::steady_clock::now();
+    std::vector<Future<long>> dag_results;
+    for (int d = 0; d < dags; ++d) {
+        std::vector<Future<long>> leaves;
+        for (int w = 0; w < width; ++w) {
+            long seed = d * width + w;
+            leaves.push_back(pool.submit([seed] { return leaf_work(seed); }));
+        }
+        dag_results.push_back(when_all(std::move(leaves)).then(pool, [](std::vector<long> values) {
+            long sum = 0;
+            for (long v : values) sum += v;
+            return sum;
+        }));
+    }
+    long pool_total = 0;
+    for (long v : when_all(std::move(dag_results)).get()) pool_total += v;
+    double pool_time = seconds_since(start);
+
+    std::printf("%d DAGs x %d leaves: std::async %.3f s, Future on ThreadPool %.3f s%s\n", dags, width,
+                std_time, pool_time, std_total == pool_total ? "" : "  (MISMATCH)");
+}
+
+// Compare the global-queue pool against the work-stealing pool at 1..64 threads
+void run_benchmark() {
+    const int roots = 200, children = 500, flat = 100000;
+    std::cout << "threads  nested-global  nested-steal  flat-global  flat-steal  (Mtasks/s)\n";
+    for (size_t threads = 1; threads <= 64; threads *= 2) {
+        double nested_tasks = roots * (children + 1.0);
+        double ng = nested_tasks / bench_nested(threads, SchedulingMode::GlobalQueue, roots, children) / 1e6;
+        double ns = nested_tasks / bench_nested(threads, SchedulingMode::WorkStealing, roots, children) / 1e6;
+        double fg = flat / bench_flat(threads, SchedulingMode::GlobalQueue, flat) / 1e6;
+        double fs = flat / bench_flat(threads, SchedulingMode::WorkStealing, flat) / 1e6;
+        std::printf("%7zu  %13.2f  %12.2f  %11.2f  %10.2f\n", threads, ng, ns, fg, fs);
+    }
+
+    std::cout << "\n1M iterations:\n";
+    run_bulk_benchmark(SchedulingMode::GlobalQueue);
+    run_bulk_benchmark(SchedulingMode::WorkStealing);
+
+    std::cout << "\nEnqueue-to-start latency by idle policy (bursts of 16 tasks):\n";
+    run_idle_policy_benchmark("park", IdlePolicy::park());
+    run_idle_policy_benchmark("spin 4k, park", IdlePolicy::spin_then_park(4000));
+    run_idle_policy_benchmark("spin 1k, yield 64", IdlePolicy::spin_yield_park(1000, 64));
+    run_idle_policy_benchmark("spin 1M, park", IdlePolicy::spin_then_park(1000000));
+
+    std::cout << "\nRequests under background load (2 workers):\n";
+    run_priority_benchmark(false);
+    run_priority_benchmark(true);
+
+    std::cout << "\nFan-out/fan-in DAGs:\n";
+    run_dag_benchmark(200, 16);
+}
+
+// Self-check: after warm-up, enqueue must not allocate. Returns the number of
+// allocations seen while running `count` tasks.
+size_t count_steady_state_allocations(SchedulingMode mode, int count) {
+    ThreadPoolOptions options;
+    options.mode = mode;
+    ThreadPool pool(4, options);
+
+    std::vector<std::future<int>> results;
+    std::atomic<int> nested(0);
+
+    auto run_batches = [&](int total, int batch) {
+        results.reserve(batch);
+        for (int done = 0; done < total; done += batch) {
+            results.clear();
+            for (int n = 0; n < batch; ++n) {
+                // Every tenth task also enqueues a child from inside the pool
+                results.emplace_back(pool.enqueue([&pool, &nested](int x) {
+                    if (x % 10 == 0) pool.enqueue([&nested] { nested.fetch_add(1, std::memory_order_relaxed); });
+                    return x * 2;
+                }, n));
+            }
+            for (auto &&result : results) result.get();
+        }
+        while (nested.load(std::memory_order_relaxed) < total / 10) std::this_thread::yield();
+        nested.store(0, std::memory_order_relaxed);
+    };
+
+    // Warm up the slab, the queues and the deques with deeper batches than we measure
+    run_batches(20000, 4000);
+    size_t before = g_allocations.load();
+    run_batches(count, 1000);
+    return g_allocations.load() - before;
+}
+
+// Hop onto a pool worker, then compute there
+coro::task<int> sum_of_squares_on(ThreadPool& pool, int n) {
+    co_await coro::schedule_on(pool);
+    int total = 0;
+    for (int i = 1; i <= n; ++i) total += i * i;
+    co_return total;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        run_benchmark();
+        return 0;
+    }
+    if (argc > 1 && std::string(argv[1]) == "alloc") {
+        size_t global = count_steady_state_allocations(SchedulingMode::GlobalQueue, 100000);
+        size_t stealing = count_steady_state_allocations(SchedulingMode::WorkStealing, 100000);
+        std::cout << "Allocations for 100000 tasks: global queue " << global
+                  << ", work stealing " << stealing << std::endl;
+        return (global == 0 && stealing == 0) ? 0 : 1;
+    }
+
+    // Create a thread pool with 4 threads that records when each task ran
+    ThreadPoolOptions options;
+    options.trace_capacity = 1024;
+    ThreadPool pool(4, options);
 
     // Enqueue 10 tasks
     std::vector<std::future<void>> results;
     for (int i = 0; i < 10; ++i) {
-        results.emplace_back(pool.enqueue(example_function, i, std::ref(print_mutex)));
+        results.emplace_back(pool.enqueue(example_function, i));
     }
 
-    // Wait for all tasks to complete
+    // Wait for all tasks to complete, and for their log lines to be written
     for (auto &&result : results) result.get();
+    alog::flush();
+
+    // Compose results with continuations instead of blocking on each one
+    std::vector<Future<int>> squares;
+    for (int i = 1; i <= 10; ++i) squares.push_back(pool.submit([i] { return i * i; }));
+    Future<int> sum = when_all(std::move(squares)).then([](std::vector<int> values) {
+        int total = 0;
+        for (int v : values) total += v;
+        return total;
+    });
+    std::cout << "Sum of squares computed by continuations: " << sum.get() << std::endl;
+
+    // The same sum from a coroutine that moves itself onto the pool
+    std::cout << "Sum of squares computed by a coroutine: " << coro::sync_wait(sum_of_squares_on(pool, 10)) << std::endl;
+
+    // Let the workers finish and record their last events, then dump the schedule
+    pool.shutdown();
+    std::ofstream trace("demo13_trace.json");
+    pool.export_chrome_trace(trace);
+    std::cout << "Scheduling trace written to demo13_trace.json (open in chrome://tracing)" << std::endl;
 
     return 0;
 }
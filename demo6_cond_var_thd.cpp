@@ -3,43 +3,172 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <vector>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <algorithm>
+#include "mpmc_queue.hpp"
 
 // Shared resources
-std::queue<int> dataQueue;
-std::mutex mtx;
-std::condition_variable cv;
 const int maxQueueSize = 10;
+BoundedMPMCQueue<int> dataQueue(maxQueueSize); // Lock-free ring; rounded up to 16 slots
 
 // Producer function
 void producer() {
     for (int i = 0; i < 20; ++i) {
         std::this_thread::sleep_for(std::chrono::milliseconds(100)); // Simulate work
-        std::unique_lock<std::mutex> lock(mtx);
-        cv.wait(lock, []{ return dataQueue.size() < maxQueueSize; }); // Wait until there's space in the queue
-        dataQueue.push(i);
+        dataQueue.push(i); // Waits until there's space in the queue
         std::cout << "Produced: " << i << std::endl;
-        lock.unlock();
-        cv.notify_all(); // Notify the consumer that data is available
     }
+    dataQueue.close(); // No more items: lets the consumer exit once the queue is drained
 }
 
 // Consumer function
 void consumer() {
-    while (true) {
-        std::unique_lock<std::mutex> lock(mtx);
-        cv.wait(lock, []{ return !dataQueue.empty(); }); // Wait until there's data in the queue
-        if (dataQueue.empty()) {
-            break; // Exit the loop if the queue is empty and no more items are produced
-        }
-        int data = dataQueue.front();
-        dataQueue.pop();
+    int data;
+    while (dataQueue.pop(data)) { // Waits until there's data; false once closed and empty
         std::cout << "Consumed: " << data << std::endl;
+    }
+}
+
+// The queue this demo used before: std::queue behind one mutex, notify_all on
+// every push and pop. Kept as the benchmark baseline.
+class CondVarQueue {
+public:
+    explicit CondVarQueue(std::size_t capacity) : capacity_(capacity) {}
+
+    void push(int value) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [this] { return queue_.size() < capacity_; });
+        queue_.push(value);
+        lock.unlock();
+        cv_.notify_all();
+    }
+
+    bool pop(int& value) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [this] { return !queue_.empty() || closed_; });
+        if (queue_.empty()) return false;
+        value = queue_.front();
+        queue_.pop();
         lock.unlock();
-        cv.notify_all(); // Notify the producer that there's space in the queue
+        cv_.notify_all();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        closed_ = true;
+        cv_.notify_all();
+    }
+
+private:
+    std::queue<int> queue_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::size_t capacity_;
+    bool closed_ = false;
+};
+
+// Move `items` integers from `producers` threads to `consumers` threads through
+// a queue of `capacity` slots; returns millions of items per second
+template<class Queue>
+double measure_throughput(int producers, int consumers, int items, std::size_t capacity) {
+    Queue queue(capacity);
+    std::vector<std::thread> threads;
+    int per_producer = items / producers;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&queue] {
+            int value;
+            long long sum = 0;
+            while (queue.pop(value)) sum += value;
+            volatile long long sink = sum;
+            (void)sink;
+        });
+    }
+    std::vector<std::thread> producer_threads;
+    for (int p = 0; p < producers; ++p) {
+        producer_threads.emplace_back([&queue, per_producer] {
+            for (int i = 0; i < per_producer; ++i) queue.push(i);
+        });
     }
+    for (auto& t : producer_threads) t.join();
+    queue.close();
+    for (auto& t : threads) t.join();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return per_producer * producers / elapsed / 1e6;
+}
+
+// Same workload through push_bulk/pop_bulk, `batch` items per call
+double measure_batched_throughput(int producers, int consumers, int items, std::size_t capacity, std::size_t batch) {
+    BoundedMPMCQueue<int> queue(capacity);
+    std::vector<std::thread> threads;
+    int per_producer = items / producers;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&queue, batch] {
+            std::vector<int> values(batch);
+            long long sum = 0;
+            while (std::size_t n = queue.pop_bulk(values.begin(), batch)) {
+                for (std::size_t i = 0; i < n; ++i) sum += values[i];
+            }
+            volatile long long sink = sum;
+            (void)sink;
+        });
+    }
+    std::vector<std::thread> producer_threads;
+    for (int p = 0; p < producers; ++p) {
+        producer_threads.emplace_back([&queue, per_producer, batch] {
+            std::vector<int> values(batch);
+            for (int i = 0; i < per_producer; i += static_cast<int>(batch)) {
+                std::size_t n = std::min<std::size_t>(batch, per_producer - i);
+                for (std::size_t k = 0; k < n; ++k) values[k] = i + static_cast<int>(k);
+                queue.push_bulk(values.begin(), n);
+            }
+        });
+    }
+    for (auto& t : producer_threads) t.join();
+    queue.close();
+    for (auto& t : threads) t.join();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    return per_producer * producers / elapsed / 1e6;
 }
 
-int main() {
+void run_benchmark(int items) {
+    const std::size_t capacity = 1024;
+    unsigned cores = std::max(2u, std::thread::hardware_concurrency());
+    int n = static_cast<int>(cores / 2);
+
+    struct Shape { const char* name; int producers; int consumers; };
+    const Shape shapes[] = {
+        {"1P1C", 1, 1},
+        {"NP1C", n, 1},
+        {"NPMC", n, n},
+    };
+
+    std::cout << "Queue throughput, " << items << " items, capacity " << capacity
+              << ", N = " << n << " (Mitems/s)\n";
+    for (const Shape& shape : shapes) {
+        double condvar = measure_throughput<CondVarQueue>(shape.producers, shape.consumers, items, capacity);
+        double mpmc = measure_throughput<BoundedMPMCQueue<int>>(shape.producers, shape.consumers, items, capacity);
+        double batched = measure_batched_throughput(shape.producers, shape.consumers, items, capacity, 32);
+        std::cout << "  " << shape.name << "  condvar queue: " << condvar
+                  << "  lock-free MPMC: " << mpmc << "  MPMC, batches of 32: " << batched << "\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && std::string(argv[1]) == "bench") {
+        run_benchmark(argc >= 3 ? std::atoi(argv[2]) : 2000000);
+        return 0;
+    }
+
     std::thread producerThread(producer);
     std::thread consumerThread(consumer);
 
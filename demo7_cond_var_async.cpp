@@ -1,59 +1,188 @@
 #include <iostream>
 #include <thread>
 #include <future>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <cstdlib>
+#include "mpmc_queue.hpp"
+#include "spsc_queue.hpp"
 
 // Shared resources
-std::queue<int> dataQueue;
-std::mutex mtx;
-std::condition_variable cv;
-const int maxQueueSize = 10;
-bool done = false; // Flag to signal termination
+const int maxQueueSize = 16; // Power of two: the SPSC ring masks instead of taking a modulo
+BlockingSPSCQueue<int, maxQueueSize> dataQueue; // One producer, one consumer: wait-free ring
 
 // Producer function
 std::future<void> producer() {
     return std::async(std::launch::async, [] {
         for (int i = 0; i < 20; ++i) {
             std::this_thread::sleep_for(std::chrono::milliseconds(100)); // Simulate work
-            std::unique_lock<std::mutex> lock(mtx);
-            cv.wait(lock, []{ return dataQueue.size() < maxQueueSize; }); // Wait until there's space in the queue
-            dataQueue.push(i);
+            dataQueue.push(i); // Waits until there's space in the queue
             std::cout << "Produced: " << i << std::endl;
-            lock.unlock();
-            cv.notify_all(); // Notify the consumer that data is available
         }
 
-        // Notify the consumer that production is done
-        std::unique_lock<std::mutex> lock(mtx);
-        done = true;
-        lock.unlock();
-        cv.notify_all(); // Notify the consumer to exit the loop
+        // Signal that production is done; the consumer exits once the queue is drained
+        dataQueue.close();
     });
 }
 
 // Consumer function
 std::future<void> consumer() {
     return std::async(std::launch::async, [] {
-        while (true) {
-            std::unique_lock<std::mutex> lock(mtx);
-            cv.wait(lock, []{ return !dataQueue.empty() || done; }); // Wait until there's data or production is done
-            if (dataQueue.empty() && done) {
-                break; // Exit the loop if the queue is empty and production is done
-            }
-            if (!dataQueue.empty()) {
-                int data = dataQueue.front();
-                dataQueue.pop();
-                std::cout << "Consumed: " << data << std::endl;
-            }
-            lock.unlock();
-            cv.notify_all(); // Notify the producer that there's space in the queue
+        int data;
+        while (dataQueue.pop(data)) { // Waits until there's data or production is done
+            std::cout << "Consumed: " << data << std::endl;
         }
     });
 }
 
-int main() {
+// Fixed-size message for the benchmark
+template<std::size_t N>
+struct Message {
+    unsigned char bytes[N];
+};
+
+const std::size_t benchCapacity = 256;
+
+// The dataQueue this demo used before: std::queue behind one mutex,
+// notify_all on every push and pop
+template<class T>
+class CondVarQueue {
+public:
+    explicit CondVarQueue(std::size_t capacity) : capacity_(capacity) {}
+
+    void push(const T& value) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [this] { return queue_.size() < capacity_; });
+        queue_.push(value);
+        lock.unlock();
+        cv_.notify_all();
+    }
+
+    bool pop(T& value) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        cv_.wait(lock, [this] { return !queue_.empty() || done_; });
+        if (queue_.empty()) return false;
+        value = queue_.front();
+        queue_.pop();
+        lock.unlock();
+        cv_.notify_all();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        done_ = true;
+        cv_.notify_all();
+    }
+
+private:
+    std::queue<T> queue_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::size_t capacity_;
+    bool done_ = false;
+};
+
+// Producer fills each message, consumer reads its first and last byte.
+// Returns millions of messages per second.
+template<std::size_t N, class Queue>
+double measure_queue(int messages) {
+    Queue queue(benchCapacity);
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&queue] {
+        Message<N> message;
+        unsigned long sum = 0;
+        while (queue.pop(message)) sum += message.bytes[0] + message.bytes[N - 1];
+        volatile unsigned long sink = sum;
+        (void)sink;
+    });
+    Message<N> message;
+    for (int i = 0; i < messages; ++i) {
+        std::memset(message.bytes, i & 0xff, N);
+        queue.push(message);
+    }
+    queue.close();
+    consumer.join();
+    return messages / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 1e6;
+}
+
+// Same traffic through BlockingSPSCQueue::push/pop (one copy in, one copy out)
+template<std::size_t N>
+double measure_spsc_copy(int messages) {
+    auto queue = std::make_unique<BlockingSPSCQueue<Message<N>, benchCapacity>>();
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&queue] {
+        Message<N> message;
+        unsigned long sum = 0;
+        while (queue->pop(message)) sum += message.bytes[0] + message.bytes[N - 1];
+        volatile unsigned long sink = sum;
+        (void)sink;
+    });
+    Message<N> message;
+    for (int i = 0; i < messages; ++i) {
+        std::memset(message.bytes, i & 0xff, N);
+        queue->push(message);
+    }
+    queue->close();
+    consumer.join();
+    return messages / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 1e6;
+}
+
+// Same traffic built and read in place with reserve/commit and peek/release
+template<std::size_t N>
+double measure_spsc_in_place(int messages) {
+    auto queue = std::make_unique<BlockingSPSCQueue<Message<N>, benchCapacity>>();
+    auto start = std::chrono::steady_clock::now();
+    std::thread consumer([&queue] {
+        unsigned long sum = 0;
+        while (Message<N>* message = queue->peek()) {
+            sum += message->bytes[0] + message->bytes[N - 1];
+            queue->release();
+        }
+        volatile unsigned long sink = sum;
+        (void)sink;
+    });
+    for (int i = 0; i < messages; ++i) {
+        auto* message = new (queue->reserve()) Message<N>;
+        std::memset(message->bytes, i & 0xff, N);
+        queue->commit();
+    }
+    queue->close();
+    consumer.join();
+    return messages / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / 1e6;
+}
+
+template<std::size_t N>
+void benchmark_size(int messages) {
+    double condvar = measure_queue<N, CondVarQueue<Message<N>>>(messages);
+    double mpmc = measure_queue<N, BoundedMPMCQueue<Message<N>>>(messages);
+    double copy = measure_spsc_copy<N>(messages);
+    double in_place = measure_spsc_in_place<N>(messages);
+    std::cout << "  " << N << " B  condvar queue: " << condvar
+              << "  MPMC queue: " << mpmc
+              << "  SPSC push/pop: " << copy
+              << "  SPSC in place: " << in_place << "\n";
+}
+
+void run_benchmark(int messages) {
+    std::cout << "1P1C throughput, " << messages << " messages, capacity " << benchCapacity << " (Mmsg/s)\n";
+    benchmark_size<8>(messages);
+    benchmark_size<64>(messages);
+    benchmark_size<512>(messages);
+    benchmark_size<4096>(messages);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && std::string(argv[1]) == "bench") {
+        run_benchmark(argc >= 3 ? std::atoi(argv[2]) : 500000);
+        return 0;
+    }
+
     // Launch producer and consumer asynchronously
     std::future<void> producerFuture = producer();
     std::future<void> consumerFuture = consumer();
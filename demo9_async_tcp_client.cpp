@@ -1,68 +1,224 @@
+#include "coro_asio.hpp" // coro::task and the coro::use_task completion token for Asio
+#include "frame_protocol.hpp" // Length-prefixed framing for keep-alive connections
+#include "response_builder.hpp" // Gathered writes of the pipelined requests
+#include "load_generator.hpp" // Many-connection load with latency histograms
+#include "socket_tuning.hpp" // Socket options, settable as key=value
+#include "async_log.hpp" // Replies are printed by a background writer
 #include <boost/asio.hpp> // Include Boost.Asio for networking
 #include <iostream> // Include iostream for console I/O
+#include <vector> // Receive buffer for keep-alive responses
+#include <limits> // Largest payload a frame header can describe
+#include <cstring> // std::memmove for partial frames
+#include <cstdlib> // std::atoi
+#include <string> // Mode selection
+#include <sys/socket.h> // sendmmsg / recvmmsg for the UDP variant
 
 using boost::asio::ip::tcp; // Using TCP from Boost.Asio's IP namespace
+using boost::asio::ip::udp; // The datagram variant of the one-shot protocol
 
-// TcpClient class to connect to the server and exchange messages
+// TcpClient class to connect to the server and exchange messages.
+// Each step is a coroutine awaiting the Asio operation directly.
 class TcpClient {
 public:
-    // Constructor initializes the socket and connects to the server
-    TcpClient(boost::asio::io_context& io_context, const tcp::resolver::results_type& endpoints)
-        : socket_(io_context) {
-        connect(endpoints); // Connect to the server
+    // Constructor initializes the socket and connects to the server. With
+    // keep_alive_messages > 0 that many framed requests are pipelined over one
+    // connection (the server must run in keepalive mode). `tuning` is applied
+    // once the connection is open.
+    TcpClient(boost::asio::io_context& io_context, const tcp::resolver::results_type& endpoints,
+              std::size_t keep_alive_messages = 0, const SocketTuning& tuning = {})
+        : socket_(io_context), tuning_(tuning) {
+        if (keep_alive_messages > 0) {
+            coro::spawn(run_keep_alive(endpoints, keep_alive_messages));
+        } else {
+            coro::spawn(run(endpoints)); // Connect to the server and exchange one message
+        }
     }
 
 private:
+    // Connect, send a message, print the reply
+    coro::task<void> run(tcp::resolver::results_type endpoints) {
+        // Results go into locals: GCC 12 miscompiles co_await inside an if condition
+        bool connected = co_await connect(endpoints);
+        if (!connected) co_return;
+        bool sent = co_await async_write(); // Write a message after connecting
+        if (!sent) co_return;
+        co_await async_read(); // Read the response after sending the message
+    }
+
+    // Connect, send all messages back to back, then print each reply as its frame completes
+    coro::task<void> run_keep_alive(tcp::resolver::results_type endpoints, std::size_t messages) {
+        bool connected = co_await connect(endpoints);
+        if (!connected) co_return;
+
+        // Every request is the same header and text, referenced as often as
+        // needed and sent with gathered writes instead of being concatenated
+        unsigned char header[frame::header_size];
+        frame::write_header(header, sizeof(message) - 1);
+        for (std::size_t queued = 0; queued < messages;) {
+            ResponseBuilder<2 * max_gather> requests;
+            for (; queued < messages && requests.available() >= 2; ++queued) {
+                requests.add(header, frame::header_size);
+                requests.add(message, sizeof(message) - 1);
+            }
+            auto [write_ec, written] = co_await boost::asio::async_write(socket_, requests.buffers(), coro::use_task);
+            if (write_ec) co_return;
+        }
+
+        // Responses may be larger than data_ when the server sends a file
+        std::vector<char> buffer(max_length);
+        std::size_t filled = 0;
+        std::size_t received = 0;
+        while (received < messages) {
+            auto [ec, length] = co_await socket_.async_read_some(
+                boost::asio::buffer(buffer.data() + filled, buffer.size() - filled), coro::use_task);
+            if (ec) break;
+            tuning_.after_read(socket_.native_handle());
+            filled += length;
+            std::size_t consumed = frame::parse(buffer.data(), filled, std::numeric_limits<std::uint32_t>::max(),
+                [&received](const char* payload, std::size_t size) {
+                    if (size <= max_printed) {
+                        alog::info("Received: ", std::string_view(payload, size));
+                    } else {
+                        alog::info("Received: ", size, " bytes");
+                    }
+                    ++received;
+                });
+            std::memmove(buffer.data(), buffer.data() + consumed, filled - consumed); // Keep the partial frame
+            filled -= consumed;
+            std::size_t needed = frame::frame_size(buffer.data(), filled);
+            if (needed > buffer.size()) buffer.resize(needed);
+        }
+
+        boost::system::error_code ec;
+        socket_.shutdown(tcp::socket::shutdown_both, ec);
+        socket_.close(ec);
+    }
+
     // Connect to the server asynchronously
-    void connect(const tcp::resolver::results_type& endpoints) {
-        boost::asio::async_connect(socket_, endpoints,
-            [this](const boost::system::error_code& ec, const tcp::endpoint& /*endpoint*/) {
-                if (!ec) { // If no error occurred
-                    async_write(); // Write a message after connecting
-                }
-            });
+    coro::task<bool> connect(const tcp::resolver::results_type& endpoints) {
+        auto [ec, endpoint] = co_await boost::asio::async_connect(socket_, endpoints, coro::use_task);
+        if (!ec) tuning_.apply(socket_.native_handle());
+        co_return !ec;
     }
 
     // Asynchronously read data from the server
-    void async_read() {
-        socket_.async_read_some(boost::asio::buffer(data_, max_length),
-            [this](boost::system::error_code ec, std::size_t length) {
-                if (!ec) { // If no error occurred
-                    std::cout << "Received: " << std::string(data_, length) << std::endl;
-                    // Close the socket after receiving the response
-                    socket_.shutdown(tcp::socket::shutdown_both, ec);
-                    socket_.close(ec);
-                }
-            });
+    coro::task<void> async_read() {
+        auto [ec, length] = co_await socket_.async_read_some(boost::asio::buffer(data_, max_length), coro::use_task);
+        if (!ec) { // If no error occurred
+            alog::info("Received: ", std::string_view(data_, length));
+            // Close the socket after receiving the response
+            socket_.shutdown(tcp::socket::shutdown_both, ec);
+            socket_.close(ec);
+        }
     }
 
     // Asynchronously write a message to the server
-    void async_write() {
-        const std::string msg = "Hello from client!"; // Message to send
-        boost::asio::async_write(socket_, boost::asio::buffer(msg),
-            [this](boost::system::error_code ec, std::size_t /*length*/) {
-                if (!ec) { // If no error occurred
-                    async_read(); // Read the response after sending the message
-                }
-            });
+    coro::task<bool> async_write() {
+        auto request = boost::asio::buffer(message, sizeof(message) - 1); // No string to build
+        auto [ec, length] = co_await boost::asio::async_write(socket_, request, coro::use_task);
+        co_return !ec;
     }
 
+    static constexpr char message[] = "Hello from client!"; // Message to send
+    static constexpr std::size_t max_gather = 32; // Requests per gathered write
+    static constexpr std::size_t max_printed = 256; // Longer responses are reported by size
+
     tcp::socket socket_; // Socket for communication with the server
+    SocketTuning tuning_;
     enum { max_length = 1024 }; // Maximum length of data to read
     char data_[max_length]; // Data buffer
 };
 
+// The one-shot protocol over UDP: send `messages` datagrams, `batch` per
+// sendmmsg, and print the replies as recvmmsg collects them. Replies still
+// missing after a second are reported as lost.
+void run_udp_client(const udp::endpoint& endpoint, std::size_t messages, std::size_t batch, const SocketTuning& tuning) {
+    boost::asio::io_context io_context;
+    udp::socket socket(io_context);
+    socket.connect(endpoint);
+    int fd = socket.native_handle();
+    tuning.apply_datagram(fd);
+    timeval timeout{1, 0};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    static constexpr char message[] = "Hello from client!";
+    static constexpr std::size_t max_reply = 1024;
+    iovec request{const_cast<char*>(message), sizeof(message) - 1};
+    std::vector<char> replies(batch * max_reply);
+    std::vector<iovec> reply_iovecs(batch);
+    std::vector<mmsghdr> requests(batch), responses(batch);
+    for (std::size_t i = 0; i < batch; ++i) {
+        requests[i].msg_hdr.msg_iov = &request;
+        requests[i].msg_hdr.msg_iovlen = 1;
+        reply_iovecs[i] = {replies.data() + i * max_reply, max_reply};
+        responses[i].msg_hdr.msg_iov = &reply_iovecs[i];
+        responses[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    std::size_t sent = 0;
+    while (sent < messages) {
+        int n = ::sendmmsg(fd, requests.data(), static_cast<unsigned>(std::min(batch, messages - sent)), 0);
+        if (n <= 0) break;
+        sent += static_cast<std::size_t>(n);
+    }
+    std::size_t received = 0;
+    while (received < sent) {
+        int n = ::recvmmsg(fd, responses.data(), static_cast<unsigned>(std::min(batch, sent - received)),
+                           MSG_WAITFORONE, nullptr);
+        if (n <= 0) break;
+        for (int i = 0; i < n; ++i) {
+            alog::info("Received: ", std::string_view(replies.data() + i * max_reply, responses[i].msg_len));
+        }
+        received += static_cast<std::size_t>(n);
+    }
+    if (received < sent) alog::warn(sent - received, " replies lost");
+}
+
 int main(int argc, char* argv[]) {
     try {
-        if (argc != 3) { // Check if the host and port are provided
-            std::cerr << "Usage: TcpClient <host> <port>\n";
+        // Socket options may follow any mode as key=value
+        SocketTuning tuning;
+        bool load = argc >= 4 && std::string(argv[3]) == "load";
+        if (!load) {
+            int kept = 1;
+            for (int i = 1; i < argc; ++i) {
+                std::string arg = argv[i];
+                auto eq = arg.find('=');
+                if (eq != std::string::npos && i >= 3 &&
+                    parse_socket_option(arg.substr(0, eq), std::atol(arg.c_str() + eq + 1), tuning)) {
+                    continue;
+                }
+                argv[kept++] = argv[i];
+            }
+            argc = kept;
+        }
+        bool udp_mode = argc >= 4 && std::string(argv[3]) == "udp";
+        if (argc < 3 || (!load && argc > (udp_mode ? 6 : 4))) { // Check if the host and port are provided
+            std::cerr << "Usage: TcpClient <host> <port> [keep-alive messages] [socket options]\n"
+                      << "       TcpClient <host> <port> udp [messages [batch]] [socket options]\n"
+                      << "       TcpClient <host> <port> load [connections=N] [threads=N] [seconds=S] [rate=R | depth=D]\n"
+                      << "                                    [size=B] [drain=S] [expected=us] [json] [socket options]\n"
+                      << "Socket options: no_delay=0|1 send_buffer=N receive_buffer=N quick_ack=0|1 busy_poll=us\n";
             return 1;
         }
 
         boost::asio::io_context io_context; // Create an IO context
         tcp::resolver resolver(io_context); // Create a resolver to find the server
+        if (udp_mode) { // Datagrams to a "<port> udp" server
+            udp::resolver udp_resolver(io_context);
+            udp::endpoint endpoint = *udp_resolver.resolve(udp::v4(), argv[1], argv[2]).begin();
+            run_udp_client(endpoint, argc >= 5 ? std::atoi(argv[4]) : 1, argc >= 6 ? std::atoi(argv[5]) : 32, tuning);
+            return 0;
+        }
         auto endpoints = resolver.resolve(argv[1], argv[2]); // Resolve the host and port
-        TcpClient client(io_context, endpoints); // Create a client and connect to the server
+        if (load) { // Load generator against a keep-alive server
+            LoadOptions options = parse_load_options(argc, argv, 4);
+            LoadGenerator generator(options, endpoints);
+            print_load_report(options, generator.run());
+            return 0;
+        }
+        std::size_t messages = argc == 4 ? std::atoi(argv[3]) : 0; // Pipelined requests on one connection
+        TcpClient client(io_context, endpoints, messages, tuning); // Create a client and connect to the server
         io_context.run(); // Run the IO context to start handling events
     } catch (std::exception& e) { // Catch any exceptions
         std::cerr << "Exception: " << e.what() << "\n";
@@ -1,91 +1,1930 @@
+#include "coro_asio.hpp" // coro::task and the coro::use_task completion token for Asio
+#include "frame_protocol.hpp" // Length-prefixed framing for keep-alive connections
+#include "response_builder.hpp" // Gathered responses, mapped files and sendfile
+#include "load_generator.hpp" // Open-loop load for the overload benchmark
+#include "timing_wheel.hpp" // Read, write and idle timeouts
+#include "socket_tuning.hpp" // TCP_NODELAY, buffer sizes, quick ACKs, busy polling, deferred accept
+#include "async_log.hpp" // Request logging off the I/O threads
 #include <boost/asio.hpp> // Include Boost.Asio for networking
 #include <iostream> // Include iostream for console I/O
 #include <memory> // Include memory for std::shared_ptr
+#include <atomic> // Allocation counter for the benchmark
+#include <cstdlib> // std::malloc / std::free
+#include <string> // Command-line mode selection
+#include <algorithm> // std::max
+#include <thread> // Client thread for the benchmark
+#include <vector> // Shards and worker threads
+#include <array> // Response header
+#include <optional> // Per-shard server constructed in place
+#include <chrono> // Benchmark timing
+#include <pthread.h> // pthread_setaffinity_np to pin shards to cores
+#include <cstring> // std::memmove for partial frames
+#include <mutex> // Guards the buffer pool's slab list
+#include <span> // Non-owning view of the gathered response buffers
+#include <cstdio> // std::remove for the benchmark body file
+#include <fstream> // Writes the benchmark body file
+#include <limits> // Largest body a frame header can describe
+#include <deque> // Timers for the timer benchmark (not movable)
+#include <stdexcept> // Timeouts on a multi-threaded io_context
+#include <sys/socket.h> // recvmmsg / sendmmsg for the UDP server
+#include <fcntl.h> // Opens /dev/null for the logging benchmark
+#ifdef WITH_IO_URING
+#include <liburing.h> // io_uring server mode (build with -DWITH_IO_URING -luring)
+#include <sys/eventfd.h> // Wakes a ring's thread for stop()
+#endif
 
 using boost::asio::ip::tcp; // Using TCP from Boost.Asio's IP namespace
+using boost::asio::ip::udp; // The datagram variant of the one-shot protocol
 
-// Session class to handle individual client connections
-class Session : public std::enable_shared_from_this<Session> {
+// Heap allocations made by the current thread (read by the "bench" mode)
+thread_local std::size_t t_allocations = 0;
+
+// noinline keeps GCC from pairing the malloc/free calls across inlined new/delete
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    ++t_allocations;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+bool g_log_requests = true; // Print every request (disabled while benchmarking)
+
+// Slab-backed pool of fixed-size read buffers. Chunks are carved out of large
+// slabs that live until the program exits. Each thread keeps a free list of up
+// to max_cached chunks, so acquire/release never lock and never call malloc
+// once a thread has warmed up. Chunks move between threads in batches through
+// a shared list under the slab mutex: a thread whose list grows past the cap
+// (it releases what sessions on other threads acquired) hands a batch back,
+// and a thread that runs out takes a batch before carving a new slab.
+class BufferPool {
+public:
+    static constexpr std::size_t chunk_size = 16 * 1024;
+    static constexpr std::size_t chunks_per_slab = 16;
+    static constexpr std::size_t max_cached = 4 * chunks_per_slab; // Per thread
+    static constexpr std::size_t batch = chunks_per_slab; // Chunks moved to or from the shared list at once
+
+    // A chunk on loan from the pool; returned when destroyed
+    class Buffer {
+    public:
+        explicit Buffer(char* data) : data_(data) {}
+        Buffer(Buffer&& other) noexcept : data_(std::exchange(other.data_, nullptr)) {}
+        Buffer& operator=(Buffer&&) = delete;
+        ~Buffer() {
+            if (data_) BufferPool::release(data_);
+        }
+
+        char* data() const { return data_; }
+        static constexpr std::size_t size() { return chunk_size; }
+
+    private:
+        char* data_;
+    };
+
+    static Buffer acquire() {
+        FreeList& local = free_list();
+        if (!local.head) refill(local);
+        FreeChunk* chunk = local.pop();
+        return Buffer(reinterpret_cast<char*>(chunk));
+    }
+
+private:
+    struct FreeChunk { FreeChunk* next; };
+
+    struct FreeList {
+        FreeChunk* head = nullptr;
+        std::size_t count = 0;
+
+        void push(FreeChunk* chunk) {
+            chunk->next = head;
+            head = chunk;
+            ++count;
+        }
+
+        FreeChunk* pop() {
+            FreeChunk* chunk = head;
+            head = chunk->next;
+            --count;
+            return chunk;
+        }
+    };
+
+    static FreeList& free_list() {
+        thread_local FreeList list;
+        return list;
+    }
+
+    // The slabs and the chunks handed back by threads with too many, guarded by mutex
+    struct Shared {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<char[]>> slabs;
+        FreeList free;
+    };
+
+    static Shared& shared() {
+        static Shared shared;
+        return shared;
+    }
+
+    static void release(char* data) {
+        FreeList& local = free_list();
+        local.push(reinterpret_cast<FreeChunk*>(data));
+        if (local.count <= max_cached) return;
+        Shared& pool = shared();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        for (std::size_t i = 0; i < batch; ++i) pool.free.push(local.pop());
+    }
+
+    // Take a batch of chunks from the shared list, or carve a new slab if it is empty
+    static void refill(FreeList& local) {
+        Shared& pool = shared();
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (pool.free.head) {
+            for (std::size_t i = 0; i < batch && pool.free.head; ++i) local.push(pool.free.pop());
+            return;
+        }
+        pool.slabs.push_back(std::make_unique<char[]>(chunk_size * chunks_per_slab));
+        char* slab = pool.slabs.back().get();
+        for (std::size_t i = 0; i < chunks_per_slab; ++i) local.push(reinterpret_cast<FreeChunk*>(slab + i * chunk_size));
+    }
+};
+
+struct ServerOptions {
+    bool keep_alive = false; // Persistent connections carrying length-prefixed requests
+    bool strand_per_session = false; // Needed when several threads run the io_context
+    const MappedFile* body = nullptr; // Keep-alive responses carry this file instead of the greeting
+    std::size_t sendfile_threshold = 64 * 1024; // File bodies at least this large go out with sendfile
+    // Bodies smaller than this are copied into one contiguous buffer per batch:
+    // below about a page, the kernel's per-iovec cost exceeds the memcpy
+    std::size_t copy_threshold = 4096;
+
+    // Backpressure, 0 = unlimited. A session never reads while it writes, so
+    // what it has read bounds what it owes; these bound what one read may
+    // commit it to, and how many sessions an acceptor takes on. Work beyond
+    // the limits waits in the kernel's socket buffers and listen backlog,
+    // where TCP flow control pushes back on the clients.
+    std::size_t max_sessions = 0; // Open sessions per TcpServer (per shard); accepting pauses at the limit
+    std::size_t max_in_flight = 0; // Requests a session takes on before it answers them and reads again
+    std::size_t max_queued_bytes = 0; // Response bytes a session takes on before it answers them and reads again
+
+    // Timeouts, 0 = none. A session that runs into one is closed. They are
+    // kept on the TcpServer's TimingWheel, so they need an io_context run by
+    // a single thread (TcpServer alone, or ShardedServer).
+    std::chrono::milliseconds idle_timeout{0}; // Keep-alive: waiting for the next request to start
+    std::chrono::milliseconds read_timeout{0}; // Waiting for the rest of a request (one-shot: for the request)
+    std::chrono::milliseconds write_timeout{0}; // Writing one batch of responses
+
+    bool has_timeouts() const { return idle_timeout.count() || read_timeout.count() || write_timeout.count(); }
+
+    SocketTuning socket; // Applied to the listening socket and every accepted one
+    std::size_t udp_batch = 32; // UdpServer: datagrams per recvmmsg / sendmmsg
+};
+
+// How often each limit was hit, over all servers (read by the overload benchmark)
+struct LimitCounters {
+    std::atomic<std::size_t> accept_pauses{0}; // Accepting stopped at max_sessions
+    std::atomic<std::size_t> in_flight_pauses{0}; // A read left requests buffered at max_in_flight
+    std::atomic<std::size_t> queued_bytes_pauses{0}; // ... at max_queued_bytes
+
+    void reset() {
+        accept_pauses = 0;
+        in_flight_pauses = 0;
+        queued_bytes_pauses = 0;
+    }
+};
+
+LimitCounters g_limits;
+
+// Sessions closed by each timeout, over all servers
+struct TimeoutCounters {
+    std::atomic<std::size_t> idle{0};
+    std::atomic<std::size_t> read{0};
+    std::atomic<std::size_t> write{0};
+};
+
+TimeoutCounters g_timeouts;
+
+// Session class to handle an individual client connection as a coroutine.
+// The coroutine frame owns the Session, so no I/O step needs shared_from_this().
+class Session {
+public:
+    // Constructor initializes the socket with a moved socket; timeouts are
+    // armed on `wheel`, if any
+    Session(tcp::socket socket, TimingWheel* wheel = nullptr)
+        : socket_(std::move(socket)), wheel_(wheel) {}
+
+    // Sessions are recycled through a per-thread free list instead of the heap
+    static void* operator new(std::size_t size) {
+        SessionPool& pool = session_pool();
+        if (FreeSession* session = pool.head) {
+            pool.head = session->next;
+            --pool.count;
+            return session;
+        }
+        return ::operator new(size);
+    }
+
+    static void operator delete(void* p) noexcept {
+        SessionPool& pool = session_pool();
+        if (pool.count == SessionPool::max_cached) {
+            ::operator delete(p);
+            return;
+        }
+        FreeSession* session = static_cast<FreeSession*>(p);
+        session->next = pool.head;
+        pool.head = session;
+        ++pool.count;
+    }
+
+    // The protocol, shared with UringServer
+    static constexpr std::size_t max_payload = BufferPool::chunk_size - frame::header_size;
+    static constexpr char response_body[] = "Hello from server!";
+
+    // Serve one connection from accept to close. A keep-alive connection
+    // carries any number of length-prefixed requests (see frame_protocol.hpp);
+    // otherwise the session answers a single unframed request and closes.
+    static coro::task<void> serve(tcp::socket socket, ServerOptions options, TimingWheel* wheel = nullptr) {
+        auto session = std::make_unique<Session>(std::move(socket), wheel);
+        options.socket.apply(session->socket_.native_handle());
+        if (options.keep_alive) {
+            co_await session->serve_frames(options);
+        } else {
+            co_await session->start(options);
+        }
+    }
+
+    // Read a request, then write the response
+    coro::task<void> start(const ServerOptions& options = {}) {
+        arm_timer(options.read_timeout, g_timeouts.read);
+        std::size_t length = co_await async_read();
+        timer_.cancel();
+        options.socket.after_read(socket_.native_handle());
+        if (length > 0) { // If no error occurred
+            arm_timer(options.write_timeout, g_timeouts.write);
+            co_await async_write(); // Write a response after reading data
+            timer_.cancel();
+        }
+    }
+
+    // Keep-alive loop: every read may hold several pipelined requests (and the
+    // start of the next one). Complete requests are answered in batches of up
+    // to max_gather responses; at most options.max_in_flight requests (or
+    // max_queued_bytes of responses) are taken on at a time, the rest stay
+    // buffered and the socket is not read again until they are all answered.
+    coro::task<void> serve_frames(const ServerOptions& options) {
+        std::size_t in_flight_limit = options.max_in_flight ? options.max_in_flight : unlimited;
+        std::size_t bytes_limit = options.max_queued_bytes
+            ? std::max<std::size_t>(1, options.max_queued_bytes / (frame::header_size + body_buffer(options).size()))
+            : unlimited;
+        std::size_t per_batch = std::min(in_flight_limit, bytes_limit);
+
+        BufferPool::Buffer buffer = BufferPool::acquire();
+        std::size_t filled = 0;
+        bool failed = false;
+        while (!failed) {
+            if (!frame::has_frame(buffer.data(), filled)) { // Read only once every buffered request is answered
+                if (filled == 0) {
+                    arm_timer(options.idle_timeout, g_timeouts.idle);
+                } else {
+                    arm_timer(options.read_timeout, g_timeouts.read);
+                }
+                auto [ec, length] = co_await socket_.async_read_some(
+                    boost::asio::buffer(buffer.data() + filled, buffer.size() - filled), coro::use_task);
+                timer_.cancel();
+                if (ec) break;
+                options.socket.after_read(socket_.native_handle());
+                filled += length;
+            }
+
+            std::size_t requests = 0;
+            std::size_t consumed = frame::parse(buffer.data(), filled, max_payload, per_batch,
+                [&requests](const char* payload, std::size_t size) {
+                    if (g_log_requests) alog::info("Received: ", std::string_view(payload, size));
+                    ++requests;
+                });
+            if (consumed == frame::invalid) break; // Frame can never fit: drop the connection
+            std::memmove(buffer.data(), buffer.data() + consumed, filled - consumed); // Keep the partial frame
+            filled -= consumed;
+            if (frame::has_frame(buffer.data(), filled)) { // A limit held requests back
+                auto& counter = per_batch == in_flight_limit ? g_limits.in_flight_pauses : g_limits.queued_bytes_pauses;
+                counter.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            while (requests > 0) {
+                std::size_t n = std::min(requests, max_gather);
+                arm_timer(options.write_timeout, g_timeouts.write);
+                bool written = co_await write_responses(n, options);
+                timer_.cancel();
+                if (!written) {
+                    failed = true;
+                    break;
+                }
+                requests -= n;
+            }
+        }
+        boost::system::error_code ec;
+        socket_.shutdown(tcp::socket::shutdown_both, ec);
+        socket_.close(ec);
+    }
+
+private:
+    struct FreeSession { FreeSession* next; };
+
+    struct SessionPool {
+        static constexpr std::size_t max_cached = 1024;
+        FreeSession* head = nullptr;
+        std::size_t count = 0;
+
+        ~SessionPool() {
+            while (head) ::operator delete(std::exchange(head, head->next));
+        }
+    };
+
+    static SessionPool& session_pool() {
+        thread_local SessionPool pool;
+        return pool;
+    }
+
+    static constexpr std::size_t max_gather = 32; // Responses per gathered write
+    static constexpr std::size_t unlimited = std::numeric_limits<std::size_t>::max();
+
+    // Arm the session's timer for the next read or write; if it expires, the
+    // socket is closed and the pending operation completes with an error
+    void arm_timer(std::chrono::milliseconds timeout, std::atomic<std::size_t>& counter) {
+        if (!wheel_ || timeout.count() == 0) return;
+        expired_counter_ = &counter;
+        wheel_->arm(timer_, timeout);
+    }
+
+    static void expire(void* context) {
+        Session* session = static_cast<Session*>(context);
+        session->expired_counter_->fetch_add(1, std::memory_order_relaxed);
+        boost::system::error_code ec;
+        session->socket_.close(ec);
+    }
+
+    static boost::asio::const_buffer body_buffer(const ServerOptions& options) {
+        return options.body ? options.body->buffer() : boost::asio::buffer(response_body, sizeof(response_body) - 1);
+    }
+
+    // Answer n requests. Each response is a length prefix and a body (the
+    // greeting or options.body). Small bodies are copied into one buffer,
+    // larger ones are referenced where they lie and the whole batch is one
+    // gathered write, and large files go out as a header and a sendfile each.
+    coro::task<bool> write_responses(std::size_t n, const ServerOptions& options) {
+        boost::asio::const_buffer body = body_buffer(options);
+        auto length = static_cast<std::uint32_t>(body.size());
+
+        if (options.body && body.size() >= options.sendfile_threshold) {
+            for (std::size_t i = 0; i < n; ++i) {
+                unsigned char header[frame::header_size];
+                frame::write_header(header, length);
+                std::size_t sent = 0;
+                while (sent < frame::header_size) { // MSG_MORE: the header rides in the body's first segment
+                    auto [ec, written] = co_await socket_.async_send(
+                        boost::asio::buffer(header + sent, frame::header_size - sent), MSG_MORE, coro::use_task);
+                    if (ec) co_return false;
+                    sent += written;
+                }
+                bool body_sent = co_await async_sendfile(socket_, options.body->fd(), 0, body.size());
+                if (!body_sent) co_return false;
+            }
+            co_return true;
+        }
+
+        if (body.size() < options.copy_threshold) {
+            copied_.clear();
+            for (std::size_t i = 0; i < n; ++i) {
+                unsigned char header[frame::header_size];
+                frame::write_header(header, length);
+                copied_.insert(copied_.end(), header, header + frame::header_size);
+                copied_.insert(copied_.end(), static_cast<const char*>(body.data()),
+                               static_cast<const char*>(body.data()) + body.size());
+            }
+            auto [ec, written] = co_await boost::asio::async_write(socket_, boost::asio::buffer(copied_), coro::use_task);
+            co_return !ec;
+        }
+
+        ResponseBuilder<2 * max_gather> batch;
+        batch.add_frame_header(length);
+        boost::asio::const_buffer header = batch.buffers()[0]; // Every response shares the one copy
+        batch.add(body);
+        for (std::size_t i = 1; i < n; ++i) {
+            batch.add(header);
+            batch.add(body);
+        }
+        auto [ec, written] = co_await boost::asio::async_write(socket_, batch.buffers(), coro::use_task);
+        co_return !ec;
+    }
+
+    // Asynchronously read data from the client; returns 0 on error
+    coro::task<std::size_t> async_read() {
+        auto [ec, length] = co_await socket_.async_read_some(boost::asio::buffer(data_, max_length), coro::use_task);
+        if (ec) co_return 0;
+        if (g_log_requests) alog::info("Received: ", std::string_view(data_, length));
+        co_return length;
+    }
+
+    // Asynchronously write a response to the client
+    coro::task<void> async_write() {
+        auto response = boost::asio::buffer(response_body, sizeof(response_body) - 1); // No string to build
+        auto [ec, length] = co_await boost::asio::async_write(socket_, response, coro::use_task);
+        if (!ec) { // If no error occurred
+            // Close the socket after sending the response
+            socket_.shutdown(tcp::socket::shutdown_both, ec);
+            socket_.close(ec);
+        }
+    }
+
+    tcp::socket socket_; // Socket for communication with the client
+    enum { max_length = 1024 }; // Maximum length of data to read
+    char data_[max_length]; // Data buffer
+    std::vector<char> copied_; // Batch of small responses, reused for the whole connection
+    TimingWheel* wheel_; // Null: no timeouts
+    TimingWheel::Timer timer_{&Session::expire, this}; // The timeout of the read or write in progress
+    std::atomic<std::size_t>* expired_counter_ = nullptr; // Counts timer_ expiring
+};
+
+// SO_REUSEPORT lets several acceptors bind the same port; the kernel then
+// spreads incoming connections across them
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+
+// Listening socket on `port` (0 picks a free port). The listener options of
+// `tuning` are set before listen(), so no connection accepted early misses them.
+tcp::acceptor make_acceptor(boost::asio::io_context& io_context, unsigned short port, bool share_port,
+                            const SocketTuning& tuning = {}) {
+    tcp::endpoint endpoint(tcp::v4(), port);
+    tcp::acceptor acceptor(io_context);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(tcp::acceptor::reuse_address(true));
+    if (share_port) acceptor.set_option(reuse_port(true));
+    acceptor.bind(endpoint);
+    tuning.apply_listener(acceptor.native_handle());
+    acceptor.listen();
+    return acceptor;
+}
+
+// TcpServer class to accept incoming client connections
+class TcpServer {
 public:
-    // Constructor initializes the socket with a moved socket
-    Session(tcp::socket socket)
+    // Constructor initializes the acceptor and starts accepting connections
+    TcpServer(boost::asio::io_context& io_context, short port, ServerOptions options = {})
+        : TcpServer(io_context, make_acceptor(io_context, port, false, options.socket), options) {}
+
+    // Serve connections from an already listening acceptor (made by make_acceptor with options.socket)
+    TcpServer(boost::asio::io_context& io_context, tcp::acceptor acceptor, ServerOptions options = {})
+        : io_context_(io_context), acceptor_(std::move(acceptor)), options_(options) {
+        if (options_.has_timeouts()) {
+            if (options_.strand_per_session) {
+                throw std::invalid_argument("Timeouts need an io_context run by one thread");
+            }
+            wheel_.emplace(io_context_);
+        }
+        start_accept(); // Start accepting connections
+    }
+
+    unsigned short port() const { return acceptor_.local_endpoint().port(); }
+
+private:
+    // Start the accept loop
+    void start_accept() {
+        coro::spawn(accept_loop());
+    }
+
+    // Accept connections, serving each one in its own coroutine, until
+    // max_sessions are open. The session that ends next restarts the loop.
+    coro::task<void> accept_loop() {
+        for (;;) {
+            if (pause_accepting()) co_return;
+            if (options_.strand_per_session) {
+                auto [error, socket] = co_await acceptor_.async_accept(boost::asio::make_strand(io_context_), coro::use_task);
+                if (!error) {
+                    ++sessions_;
+                    coro::spawn(serve(tcp::socket(std::move(socket))));
+                }
+            } else {
+                auto [error, socket] = co_await acceptor_.async_accept(coro::use_task);
+                if (!error) { // If no error occurred
+                    ++sessions_;
+                    coro::spawn(serve(std::move(socket)));
+                }
+            }
+        }
+    }
+
+    // True if the accept loop must stop at max_sessions. Sessions may end on
+    // other threads; one that ended before paused_ was set would not have
+    // seen it, so the count is checked again afterwards.
+    bool pause_accepting() {
+        if (options_.max_sessions == 0 || sessions_ < options_.max_sessions) return false;
+        paused_ = true;
+        if (sessions_ < options_.max_sessions && paused_.exchange(false)) return false;
+        g_limits.accept_pauses.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    coro::task<void> serve(tcp::socket socket) {
+        co_await Session::serve(std::move(socket), options_, wheel_ ? &*wheel_ : nullptr);
+        --sessions_;
+        if (paused_.exchange(false)) start_accept(); // Below the limit again
+    }
+
+    boost::asio::io_context& io_context_; // Reference to the IO context
+    tcp::acceptor acceptor_; // Acceptor to listen for incoming connections
+    ServerOptions options_;
+    std::atomic<std::size_t> sessions_{0}; // Open sessions
+    std::atomic<bool> paused_{false}; // The accept loop stopped at max_sessions
+    std::optional<TimingWheel> wheel_; // Sessions' timeouts, if any are set
+};
+
+// Pin a thread to one core (wrapping around if there are fewer cores)
+void pin_to_core(std::thread& thread, unsigned core) {
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores, &set);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+}
+
+// N independent shards, each an io_context on its own pinned thread with its
+// own SO_REUSEPORT acceptor. A connection is accepted and served by the same
+// thread for its whole life, so shards share no state and no locks.
+class ShardedServer {
+public:
+    ShardedServer(unsigned short port, unsigned shards, ServerOptions options = {}) {
+        for (unsigned i = 0; i < shards; ++i) {
+            auto shard = std::make_unique<Shard>();
+            // Shard 0 resolves port 0 to a real port; the others bind that one
+            tcp::acceptor acceptor = make_acceptor(shard->io_context, i == 0 ? port : port_, true, options.socket);
+            port_ = acceptor.local_endpoint().port();
+            shard->server.emplace(shard->io_context, std::move(acceptor), options);
+            shards_.push_back(std::move(shard));
+        }
+    }
+
+    unsigned short port() const { return port_; }
+
+    void start() {
+        for (unsigned i = 0; i < shards_.size(); ++i) {
+            threads_.emplace_back([shard = shards_[i].get()] { shard->io_context.run(); });
+            pin_to_core(threads_.back(), i);
+        }
+    }
+
+    void stop() {
+        for (auto& shard : shards_) shard->io_context.stop();
+        join();
+    }
+
+    void join() {
+        for (auto& thread : threads_) thread.join();
+        threads_.clear();
+    }
+
+private:
+    struct Shard {
+        boost::asio::io_context io_context{1}; // Concurrency hint: run by one thread only
+        std::optional<TcpServer> server;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::vector<std::thread> threads_;
+    unsigned short port_ = 0;
+};
+
+// The alternative layout: one io_context and one acceptor, run() by N threads.
+// Any thread may complete any operation, so each session runs on a strand.
+class SharedServer {
+public:
+    SharedServer(unsigned short port, unsigned threads, ServerOptions options = {})
+        : io_context_(static_cast<int>(threads)),
+          server_(io_context_, make_acceptor(io_context_, port, false, options.socket), with_strands(options)),
+          thread_count_(threads) {}
+
+    unsigned short port() const { return server_.port(); }
+
+    void start() {
+        for (unsigned i = 0; i < thread_count_; ++i) {
+            threads_.emplace_back([this] { io_context_.run(); });
+        }
+    }
+
+    void stop() {
+        io_context_.stop();
+        join();
+    }
+
+    void join() {
+        for (auto& thread : threads_) thread.join();
+        threads_.clear();
+    }
+
+private:
+    static ServerOptions with_strands(ServerOptions options) {
+        options.strand_per_session = true;
+        return options;
+    }
+
+    boost::asio::io_context io_context_;
+    TcpServer server_;
+    unsigned thread_count_;
+    std::vector<std::thread> threads_;
+};
+
+// The one-shot protocol over UDP: every datagram is a request and is answered
+// with the greeting. Once the socket is readable, recvmmsg drains up to
+// `batch` datagrams per syscall and one sendmmsg answers all of them, so a
+// burst costs two syscalls instead of two per datagram.
+class UdpServer {
+public:
+    static constexpr std::size_t max_datagram = 2048; // Longer requests are truncated
+
+    UdpServer(boost::asio::io_context& io_context, unsigned short port, const ServerOptions& options = {})
+        : socket_(io_context, udp::endpoint(udp::v4(), port)), batch_(std::max<std::size_t>(1, options.udp_batch)),
+          requests_(batch_), responses_(batch_), request_iovecs_(batch_), addresses_(batch_),
+          buffers_(batch_ * max_datagram) {
+        options.socket.apply_datagram(socket_.native_handle());
+        response_iovec_.iov_base = const_cast<char*>(Session::response_body);
+        response_iovec_.iov_len = sizeof(Session::response_body) - 1;
+        for (std::size_t i = 0; i < batch_; ++i) {
+            request_iovecs_[i] = {buffers_.data() + i * max_datagram, max_datagram};
+            requests_[i].msg_hdr.msg_iov = &request_iovecs_[i];
+            requests_[i].msg_hdr.msg_iovlen = 1;
+            requests_[i].msg_hdr.msg_name = &addresses_[i];
+            responses_[i].msg_hdr.msg_iov = &response_iovec_;
+            responses_[i].msg_hdr.msg_iovlen = 1;
+            responses_[i].msg_hdr.msg_name = &addresses_[i];
+        }
+        coro::spawn(serve());
+    }
+
+    unsigned short port() const { return socket_.local_endpoint().port(); }
+
+private:
+    coro::task<void> serve() {
+        int fd = socket_.native_handle();
+        for (;;) {
+            boost::system::error_code ec = co_await socket_.async_wait(udp::socket::wait_read, coro::use_task);
+            if (ec) co_return;
+            for (;;) {
+                for (auto& request : requests_) request.msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+                int received = ::recvmmsg(fd, requests_.data(), static_cast<unsigned>(batch_), MSG_DONTWAIT, nullptr);
+                if (received <= 0) break; // Drained (EAGAIN) or failed: wait for the socket again
+                for (int i = 0; i < received; ++i) {
+                    if (g_log_requests) {
+                        alog::info("Received: ", std::string_view(buffers_.data() + i * max_datagram, requests_[i].msg_len));
+                    }
+                    responses_[i].msg_hdr.msg_namelen = requests_[i].msg_hdr.msg_namelen;
+                }
+                // Datagrams may be dropped: when the send buffer is full the rest of the batch is
+                for (int sent = 0; sent < received;) {
+                    int n = ::sendmmsg(fd, responses_.data() + sent, static_cast<unsigned>(received - sent), MSG_DONTWAIT);
+                    if (n <= 0) break;
+                    sent += n;
+                }
+            }
+        }
+    }
+
+    udp::socket socket_;
+    std::size_t batch_;
+    std::vector<mmsghdr> requests_;
+    std::vector<mmsghdr> responses_; // Each one answers the request at the same index
+    std::vector<iovec> request_iovecs_;
+    std::vector<sockaddr_storage> addresses_; // Senders, shared by each request and its response
+    std::vector<char> buffers_; // batch_ receive buffers of max_datagram bytes
+    iovec response_iovec_{}; // Every response is the greeting
+};
+
+#ifdef WITH_IO_URING
+struct UringOptions {
+    unsigned entries = 4096; // Submission queue entries per ring
+    unsigned buffers = 1024; // Provided receive buffers per ring (a power of two)
+    unsigned buffer_size = 4096; // Bytes per receive buffer
+    bool sqpoll = false; // A kernel thread polls the submission queue, so submitting takes no syscall
+};
+
+// The Session protocol (one-shot, or keep-alive with length-prefixed
+// requests) served from io_uring instead of Asio's epoll reactor. Like
+// ShardedServer, every shard is a thread pinned to its own core with its own
+// SO_REUSEPORT listening socket, here driving its own ring:
+//   - one multishot accept yields a completion per new connection;
+//   - one multishot recv per connection yields a completion per chunk of
+//     data, in a buffer the kernel picks from a ring of provided buffers, so
+//     idle connections hold no receive memory;
+//   - all requests prepared while draining a batch of completions are
+//     submitted with the same io_uring_enter that waits for the next batch.
+// Responses are copied into a per-connection buffer (they are small; see
+// ServerOptions::copy_threshold) and sent with one send per batch.
+class UringServer {
+public:
+    UringServer(unsigned short port, unsigned shards, ServerOptions options = {}, UringOptions uring = {}) {
+        for (unsigned i = 0; i < shards; ++i) {
+            // Shard 0 resolves port 0 to a real port; the others bind that one
+            shards_.push_back(std::make_unique<Shard>(i == 0 ? port : port_, options, uring));
+            port_ = shards_.back()->port();
+        }
+    }
+
+    ~UringServer() {
+        if (!threads_.empty()) stop();
+    }
+
+    unsigned short port() const { return port_; }
+
+    void start() {
+        for (unsigned i = 0; i < shards_.size(); ++i) {
+            threads_.emplace_back([shard = shards_[i].get()] { shard->run(); });
+            pin_to_core(threads_.back(), i);
+        }
+    }
+
+    void stop() {
+        for (auto& shard : shards_) shard->wake();
+        join();
+    }
+
+    void join() {
+        for (auto& thread : threads_) thread.join();
+        threads_.clear();
+    }
+
+private:
+    class Shard {
+    public:
+        Shard(unsigned short port, ServerOptions options, UringOptions uring)
+            : acceptor_(make_acceptor(io_context_, port, true, options.socket)), options_(options), uring_(uring),
+              buffer_memory_(static_cast<std::size_t>(uring.buffers) * uring.buffer_size) {
+            io_uring_params params{};
+            params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL;
+            params.cq_entries = uring.entries * 4; // Multishot requests complete many times each
+            if (uring.sqpoll) {
+                params.flags |= IORING_SETUP_SQPOLL;
+                params.sq_thread_idle = 1000; // ms without submissions before the poller sleeps
+            } else {
+                // Only this shard's thread submits, and completions are processed
+                // only when it asks for them: no task-work interrupts while it runs.
+                // The ring starts disabled so that run() can claim it from that thread.
+                params.flags |= IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED;
+            }
+            int ret = io_uring_queue_init_params(uring.entries, &ring_, &params);
+            if (ret == -EINVAL && !uring.sqpoll) { // Kernels before 6.1
+                params.flags &= ~(IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_R_DISABLED);
+                ret = io_uring_queue_init_params(uring.entries, &ring_, &params);
+            }
+            if (ret < 0) throw std::system_error(-ret, std::generic_category(), "io_uring_queue_init_params");
+            disabled_ = params.flags & IORING_SETUP_R_DISABLED;
+
+            buffer_ring_ = io_uring_setup_buf_ring(&ring_, uring.buffers, buffer_group, 0, &ret);
+            if (!buffer_ring_) {
+                io_uring_queue_exit(&ring_);
+                throw std::system_error(-ret, std::generic_category(), "io_uring_setup_buf_ring (needs Linux 6.0)");
+            }
+            for (unsigned bid = 0; bid < uring.buffers; ++bid) recycle(bid);
+            io_uring_buf_ring_advance(buffer_ring_, static_cast<int>(returned_));
+            returned_ = 0;
+
+            wake_fd_ = ::eventfd(0, EFD_CLOEXEC);
+            if (wake_fd_ < 0) {
+                int error = errno;
+                io_uring_free_buf_ring(&ring_, buffer_ring_, uring.buffers, buffer_group);
+                io_uring_queue_exit(&ring_);
+                throw std::system_error(error, std::generic_category(), "eventfd");
+            }
+        }
+
+        ~Shard() {
+            for (auto& connection : connections_) {
+                if (connection && connection->open) ::close(connection->fd);
+            }
+            io_uring_free_buf_ring(&ring_, buffer_ring_, uring_.buffers, buffer_group);
+            io_uring_queue_exit(&ring_);
+            ::close(wake_fd_);
+        }
+
+        unsigned short port() const { return acceptor_.local_endpoint().port(); }
+
+        // Ask run() to return; callable from any thread
+        void wake() {
+            std::uint64_t one = 1;
+            [[maybe_unused]] ssize_t n = ::write(wake_fd_, &one, sizeof(one));
+        }
+
+        void run() {
+            if (disabled_) io_uring_enable_rings(&ring_); // This thread becomes the ring's only submitter
+            arm_accept();
+            prepare(Op::wake, wake_fd_, [this](io_uring_sqe* sqe) {
+                io_uring_prep_read(sqe, wake_fd_, &wake_value_, sizeof(wake_value_), 0);
+            });
+            while (!stopping_) {
+                int ret = io_uring_submit_and_wait(&ring_, 1);
+                if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+                    alog::error("io_uring_submit_and_wait: ", std::strerror(-ret));
+                    return;
+                }
+                unsigned head;
+                unsigned seen = 0;
+                io_uring_cqe* cqe;
+                io_uring_for_each_cqe(&ring_, head, cqe) {
+                    complete(cqe);
+                    ++seen;
+                }
+                io_uring_cq_advance(&ring_, seen);
+                if (returned_) { // Hand the buffers consumed by this batch back in one go
+                    io_uring_buf_ring_advance(buffer_ring_, static_cast<int>(returned_));
+                    returned_ = 0;
+                }
+            }
+        }
+
+    private:
+        enum class Op : std::uint64_t { accept, recv, send, wake, ignore };
+        static constexpr int buffer_group = 0;
+
+        struct Connection {
+            int fd = -1;
+            bool open = false;
+            bool receiving = false; // Multishot recv armed
+            bool sending = false; // A send is in flight
+            bool closing = false;
+            bool answered = false; // One-shot connection: close once the response is sent
+            std::vector<char> pending; // Incomplete frame carried over from earlier reads
+            std::vector<char> queued; // Responses waiting for the current send to finish
+            std::vector<char> in_flight; // Bytes handed to the current send
+            std::size_t sent = 0; // Bytes of in_flight already sent
+        };
+
+        // user_data: the operation in the top byte, the socket below
+        static std::uint64_t tag(Op op, int fd) {
+            return (static_cast<std::uint64_t>(op) << 56) | static_cast<std::uint32_t>(fd);
+        }
+
+        // Fill the next free SQE; if the queue is full, submit what is there first
+        template<class Prep>
+        void prepare(Op op, int fd, Prep&& prep) {
+            io_uring_sqe* sqe;
+            while (!(sqe = io_uring_get_sqe(&ring_))) io_uring_submit(&ring_);
+            prep(sqe);
+            io_uring_sqe_set_data64(sqe, tag(op, fd));
+        }
+
+        void arm_accept() {
+            int fd = acceptor_.native_handle();
+            prepare(Op::accept, fd, [fd](io_uring_sqe* sqe) {
+                io_uring_prep_multishot_accept(sqe, fd, nullptr, nullptr, SOCK_CLOEXEC);
+            });
+        }
+
+        void arm_recv(Connection& connection) {
+            connection.receiving = true;
+            prepare(Op::recv, connection.fd, [fd = connection.fd](io_uring_sqe* sqe) {
+                io_uring_prep_recv_multishot(sqe, fd, nullptr, 0, 0);
+                sqe->flags |= IOSQE_BUFFER_SELECT; // The kernel picks a buffer from the group
+                sqe->buf_group = buffer_group;
+            });
+        }
+
+        char* buffer(unsigned bid) { return buffer_memory_.data() + static_cast<std::size_t>(bid) * uring_.buffer_size; }
+
+        void recycle(unsigned bid) {
+            io_uring_buf_ring_add(buffer_ring_, buffer(bid), uring_.buffer_size, static_cast<unsigned short>(bid),
+                                  io_uring_buf_ring_mask(uring_.buffers), static_cast<int>(returned_++));
+        }
+
+        void complete(io_uring_cqe* cqe) {
+            std::uint64_t data = io_uring_cqe_get_data64(cqe);
+            auto op = static_cast<Op>(data >> 56);
+            int fd = static_cast<int>(data & 0xffffffffu);
+            bool more = cqe->flags & IORING_CQE_F_MORE;
+            switch (op) {
+            case Op::accept:
+                if (cqe->res >= 0) open_connection(cqe->res);
+                if (!more && !stopping_) arm_accept();
+                break;
+            case Op::recv:
+                on_recv(*connections_[fd], cqe, more);
+                break;
+            case Op::send:
+                on_send(*connections_[fd], cqe->res);
+                break;
+            case Op::wake:
+                stopping_ = true;
+                break;
+            case Op::ignore: // shutdown and close
+                break;
+            }
+        }
+
+        void open_connection(int fd) {
+            if (static_cast<std::size_t>(fd) >= connections_.size()) connections_.resize(fd + 1);
+            if (!connections_[fd]) connections_[fd] = std::make_unique<Connection>();
+            Connection& connection = *connections_[fd]; // Reused with its buffers' capacity
+            connection.fd = fd;
+            connection.open = true;
+            connection.closing = connection.answered = false;
+            connection.pending.clear();
+            connection.queued.clear();
+            options_.socket.apply(fd);
+            arm_recv(connection);
+        }
+
+        void on_recv(Connection& connection, io_uring_cqe* cqe, bool more) {
+            if (!more) connection.receiving = false;
+            if (cqe->res > 0) {
+                options_.socket.after_read(connection.fd);
+                unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                if (!connection.closing) on_data(connection, buffer(bid), static_cast<std::size_t>(cqe->res));
+                recycle(bid);
+            } else if (cqe->res != -ENOBUFS) { // End of stream or error; ENOBUFS only means re-arm
+                begin_close(connection);
+            }
+            if (!connection.receiving && !connection.closing) arm_recv(connection);
+            release_if_done(connection);
+        }
+
+        void on_data(Connection& connection, const char* data, std::size_t size) {
+            if (!options_.keep_alive) {
+                if (g_log_requests) alog::info("Received: ", std::string_view(data, size));
+                if (connection.answered) return;
+                connection.answered = true;
+                connection.queued.insert(connection.queued.end(), Session::response_body,
+                                         Session::response_body + sizeof(Session::response_body) - 1);
+                flush(connection);
+                return;
+            }
+
+            // Parse straight out of the provided buffer; only a trailing partial
+            // frame is copied, to be completed by the next read
+            if (!connection.pending.empty()) {
+                connection.pending.insert(connection.pending.end(), data, data + size);
+                data = connection.pending.data();
+                size = connection.pending.size();
+            }
+            std::size_t requests = 0;
+            std::size_t consumed = frame::parse(data, size, Session::max_payload,
+                [&requests](const char* payload, std::size_t length) {
+                    if (g_log_requests) alog::info("Received: ", std::string_view(payload, length));
+                    ++requests;
+                });
+            if (consumed == frame::invalid) { // Frame can never fit: drop the connection
+                begin_close(connection);
+                return;
+            }
+            if (connection.pending.empty()) {
+                connection.pending.assign(data + consumed, data + size);
+            } else {
+                connection.pending.erase(connection.pending.begin(), connection.pending.begin() + consumed);
+            }
+
+            unsigned char header[frame::header_size];
+            frame::write_header(header, sizeof(Session::response_body) - 1);
+            for (std::size_t i = 0; i < requests; ++i) {
+                connection.queued.insert(connection.queued.end(), header, header + frame::header_size);
+                connection.queued.insert(connection.queued.end(), Session::response_body,
+                                         Session::response_body + sizeof(Session::response_body) - 1);
+            }
+            flush(connection);
+        }
+
+        // Start sending the queued responses unless a send is already in flight
+        void flush(Connection& connection) {
+            if (connection.sending || connection.queued.empty()) return;
+            std::swap(connection.queued, connection.in_flight);
+            connection.queued.clear();
+            connection.sent = 0;
+            send(connection);
+        }
+
+        void send(Connection& connection) {
+            connection.sending = true;
+            prepare(Op::send, connection.fd, [&connection](io_uring_sqe* sqe) {
+                io_uring_prep_send(sqe, connection.fd, connection.in_flight.data() + connection.sent,
+                                   connection.in_flight.size() - connection.sent, MSG_NOSIGNAL);
+            });
+        }
+
+        void on_send(Connection& connection, int result) {
+            connection.sending = false;
+            if (result < 0) {
+                begin_close(connection);
+            } else if (connection.sent += static_cast<std::size_t>(result); connection.sent < connection.in_flight.size()) {
+                send(connection); // Short send: the rest of the batch
+            } else if (connection.answered && connection.queued.empty()) {
+                begin_close(connection); // One-shot connection: response delivered
+            } else {
+                flush(connection);
+            }
+            release_if_done(connection);
+        }
+
+        // Shut the socket down; it is closed once no operation refers to it
+        void begin_close(Connection& connection) {
+            if (connection.closing) return;
+            connection.closing = true;
+            if (connection.receiving) { // Ends the multishot recv
+                prepare(Op::ignore, connection.fd, [fd = connection.fd](io_uring_sqe* sqe) {
+                    io_uring_prep_shutdown(sqe, fd, SHUT_RDWR);
+                });
+            }
+        }
+
+        void release_if_done(Connection& connection) {
+            if (!connection.open || !connection.closing || connection.receiving || connection.sending) return;
+            connection.open = false;
+            prepare(Op::ignore, connection.fd, [fd = connection.fd](io_uring_sqe* sqe) {
+                io_uring_prep_close(sqe, fd);
+            });
+        }
+
+        boost::asio::io_context io_context_; // Only owns the acceptor; the ring does the I/O
+        tcp::acceptor acceptor_;
+        ServerOptions options_;
+        UringOptions uring_;
+        io_uring ring_;
+        io_uring_buf_ring* buffer_ring_ = nullptr;
+        std::vector<char> buffer_memory_;
+        unsigned returned_ = 0; // Buffers recycled since the last io_uring_buf_ring_advance
+        int wake_fd_ = -1;
+        std::uint64_t wake_value_ = 0;
+        bool disabled_ = false; // Created with IORING_SETUP_R_DISABLED
+        bool stopping_ = false;
+        std::vector<std::unique_ptr<Connection>> connections_; // Indexed by socket
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::vector<std::thread> threads_;
+    unsigned short port_ = 0;
+};
+#endif // WITH_IO_URING
+
+// The callback-based Session/TcpServer this demo used before the coroutine port.
+// Kept as the baseline for the allocation benchmark.
+class CallbackSession : public std::enable_shared_from_this<CallbackSession> {
+public:
+    CallbackSession(tcp::socket socket)
         : socket_(std::move(socket)) {}
 
-    // Start the session by initiating an asynchronous read
     void start() {
         async_read();
     }
 
 private:
-    // Asynchronously read data from the client
     void async_read() {
         auto self(shared_from_this()); // Keep a shared pointer to this instance
         socket_.async_read_some(boost::asio::buffer(data_, max_length),
             [this, self](boost::system::error_code ec, std::size_t length) {
-                if (!ec) { // If no error occurred
-                    std::cout << "Received: " << std::string(data_, length) << std::endl;
-                    async_write(); // Write a response after reading data
+                if (!ec) {
+                    if (g_log_requests) alog::info("Received: ", std::string_view(data_, length));
+                    async_write();
                 }
             });
     }
 
-    // Asynchronously write a response to the client
     void async_write() {
         auto self(shared_from_this()); // Keep a shared pointer to this instance
-        const std::string msg = "Hello from server!"; // Response message
+        const std::string msg = "Hello from server!";
         boost::asio::async_write(socket_, boost::asio::buffer(msg),
             [this, self](boost::system::error_code ec, std::size_t /*length*/) {
-                if (!ec) { // If no error occurred
-                    // Close the socket after sending the response
+                if (!ec) {
                     socket_.shutdown(tcp::socket::shutdown_both, ec);
                     socket_.close(ec);
                 }
             });
     }
 
-    tcp::socket socket_; // Socket for communication with the client
-    enum { max_length = 1024 }; // Maximum length of data to read
-    char data_[max_length]; // Data buffer
+    tcp::socket socket_;
+    enum { max_length = 1024 };
+    char data_[max_length];
 };
 
-// TcpServer class to accept incoming client connections
-class TcpServer {
+class CallbackTcpServer {
 public:
-    // Constructor initializes the acceptor and starts accepting connections
-    TcpServer(boost::asio::io_context& io_context, short port)
+    CallbackTcpServer(boost::asio::io_context& io_context, short port)
         : io_context_(io_context), acceptor_(io_context, tcp::endpoint(tcp::v4(), port)) {
-        start_accept(); // Start accepting connections
+        start_accept();
     }
 
+    unsigned short port() const { return acceptor_.local_endpoint().port(); }
+
 private:
-    // Start accepting new client connections
     void start_accept() {
-        // Create a new socket for the next connection
         auto new_session = std::make_shared<tcp::socket>(io_context_);
-        // Asynchronously accept a new connection
         acceptor_.async_accept(*new_session,
             [this, new_session](const boost::system::error_code& error) {
-                if (!error) { // If no error occurred
-                    // Start a new session for the accepted connection
-                    std::make_shared<Session>(std::move(*new_session))->start();
+                if (!error) {
+                    std::make_shared<CallbackSession>(std::move(*new_session))->start();
                 }
-                start_accept(); // Continue accepting connections
+                start_accept();
             });
     }
 
-    boost::asio::io_context& io_context_; // Reference to the IO context
-    tcp::acceptor acceptor_; // Acceptor to listen for incoming connections
+    boost::asio::io_context& io_context_;
+    tcp::acceptor acceptor_;
 };
 
+// Benchmark: serve `connections` sequential loopback connections and report the
+// server thread's heap allocations per connection
+template<class Server>
+double allocations_per_connection(int connections) {
+    boost::asio::io_context io_context;
+    Server server(io_context, 0);
+    unsigned short port = server.port();
+
+    std::thread client([&io_context, port, connections] {
+        boost::asio::io_context client_context;
+        const std::string msg = "Hello from client!";
+        char reply[64];
+        for (int n = 0; n < connections; ++n) {
+            tcp::socket socket(client_context);
+            socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+            boost::asio::write(socket, boost::asio::buffer(msg));
+            boost::system::error_code ec;
+            while (!ec) socket.read_some(boost::asio::buffer(reply), ec); // Until the server closes
+        }
+        io_context.stop();
+    });
+
+    std::size_t before = t_allocations;
+    io_context.run();
+    std::size_t allocations = t_allocations - before;
+    client.join();
+    return static_cast<double>(allocations) / connections;
+}
+
+void run_benchmark(int connections) {
+    g_log_requests = false;
+
+    double callbacks = allocations_per_connection<CallbackTcpServer>(connections);
+
+    coro::FrameAllocator::recycling = false;
+    double coroutines_heap = allocations_per_connection<TcpServer>(connections);
+
+    coro::FrameAllocator::recycling = true;
+    std::size_t frames_before = coro::FrameAllocator::heap_allocations;
+    double coroutines_recycled = allocations_per_connection<TcpServer>(connections);
+    std::size_t frames_from_heap = coro::FrameAllocator::heap_allocations - frames_before;
+
+    std::cout << "Server-thread heap allocations per connection (" << connections << " connections):\n"
+              << "  callbacks + shared_from_this:     " << callbacks << "\n"
+              << "  coroutines, frames from heap:     " << coroutines_heap << "\n"
+              << "  coroutines, recycled frames:      " << coroutines_recycled
+              << "  (" << frames_from_heap << " frames ever taken from the heap)\n";
+}
+
+// Server-thread heap allocations per request on one keep-alive connection,
+// measured over `requests` round trips after a warm-up
+double allocations_per_keep_alive_request(int requests) {
+    g_log_requests = false;
+    boost::asio::io_context io_context;
+    ServerOptions options;
+    options.keep_alive = true;
+    TcpServer server(io_context, 0, options);
+    unsigned short port = server.port();
+    std::size_t before = 0;
+    std::size_t after = 0;
+
+    std::thread client([&io_context, &before, &after, port, requests] {
+        boost::asio::io_context client_context;
+        tcp::socket socket(client_context);
+        socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+        socket.set_option(tcp::no_delay(true));
+        const std::string msg = "Hello from client!";
+        unsigned char header[frame::header_size];
+        frame::write_header(header, static_cast<std::uint32_t>(msg.size()));
+        std::array<boost::asio::const_buffer, 2> request = {boost::asio::buffer(header), boost::asio::buffer(msg)};
+        char reply[frame::header_size + 64];
+        auto round_trips = [&](int n) {
+            for (int i = 0; i < n; ++i) {
+                boost::asio::write(socket, request);
+                boost::asio::read(socket, boost::asio::buffer(reply, frame::header_size + 18));
+            }
+        };
+        // The marks are posted handlers, so they read the server thread's counter
+        round_trips(1000);
+        boost::asio::post(io_context, [&before] { before = t_allocations; });
+        round_trips(requests);
+        boost::asio::post(io_context, [&after, &io_context] { after = t_allocations; io_context.stop(); });
+    });
+
+    io_context.run();
+    client.join();
+    return static_cast<double>(after - before) / requests;
+}
+
+// Load generator: `clients` threads each run connect / send / read-until-close
+// loops against `port` for `seconds`. Returns completed exchanges per second.
+double exchanges_per_second(unsigned short port, unsigned clients, double seconds) {
+    std::atomic<std::size_t> completed{0};
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    std::vector<std::thread> threads;
+    for (unsigned c = 0; c < clients; ++c) {
+        threads.emplace_back([&completed, deadline, port] {
+            boost::asio::io_context client_context;
+            const std::string msg = "Hello from client!";
+            char reply[64];
+            std::size_t done = 0;
+            while (std::chrono::steady_clock::now() < deadline) {
+                tcp::socket socket(client_context);
+                boost::system::error_code ec;
+                socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port), ec);
+                if (ec) continue;
+                boost::asio::write(socket, boost::asio::buffer(msg), ec);
+                std::size_t received = 0;
+                while (!ec) received += socket.read_some(boost::asio::buffer(reply), ec);
+                if (received > 0) ++done;
+            }
+            completed += done;
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    return completed / seconds;
+}
+
+// Keep-alive load: each client thread keeps one connection open and sends
+// `depth` pipelined requests per round trip. Returns requests per second.
+double requests_per_second(unsigned short port, unsigned clients, double seconds, std::size_t depth) {
+    std::atomic<std::size_t> completed{0};
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    std::vector<std::thread> threads;
+    for (unsigned c = 0; c < clients; ++c) {
+        threads.emplace_back([&completed, deadline, port, depth] {
+            boost::asio::io_context client_context;
+            tcp::socket socket(client_context);
+            socket.connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+            socket.set_option(tcp::no_delay(true));
+
+            // One round trip's worth of framed requests, sent with a single write
+            const std::string msg = "Hello from client!";
+            std::vector<char> batch;
+            for (std::size_t i = 0; i < depth; ++i) {
+                unsigned char header[frame::header_size];
+                frame::write_header(header, static_cast<std::uint32_t>(msg.size()));
+                batch.insert(batch.end(), header, header + frame::header_size);
+                batch.insert(batch.end(), msg.begin(), msg.end());
+            }
+
+            std::vector<char> buffer(64 * 1024);
+            std::size_t filled = 0;
+            std::size_t done = 0;
+            boost::system::error_code ec;
+            while (!ec && std::chrono::steady_clock::now() < deadline) {
+                boost::asio::write(socket, boost::asio::buffer(batch), ec);
+                std::size_t responses = 0;
+                while (!ec && responses < depth) {
+                    filled += socket.read_some(boost::asio::buffer(buffer.data() + filled, buffer.size() - filled), ec);
+                    std::size_t consumed = frame::parse(buffer.data(), filled, std::numeric_limits<std::uint32_t>::max(),
+                        [&responses](const char*, std::size_t) { ++responses; });
+                    std::memmove(buffer.data(), buffer.data() + consumed, filled - consumed);
+                    filled -= consumed;
+                    std::size_t needed = frame::frame_size(buffer.data(), filled);
+                    if (needed > buffer.size()) buffer.resize(needed); // Large file bodies
+                }
+                if (!ec) done += depth;
+            }
+            completed += done;
+        });
+    }
+    for (auto& thread : threads) thread.join();
+    return completed / seconds;
+}
+
+// One keep-alive client connection for connection_load(): `depth` pipelined
+// requests per round trip until the deadline
+coro::task<void> load_connection(boost::asio::io_context& io_context, unsigned short port, std::size_t depth,
+                                 std::chrono::steady_clock::time_point deadline, std::size_t& completed) {
+    tcp::socket socket(io_context);
+    boost::system::error_code ec = co_await socket.async_connect(
+        tcp::endpoint(boost::asio::ip::address_v4::loopback(), port), coro::use_task);
+    if (ec) co_return;
+    socket.set_option(tcp::no_delay(true), ec);
+
+    std::vector<char> batch;
+    for (std::size_t i = 0; i < depth; ++i) {
+        unsigned char header[frame::header_size];
+        frame::write_header(header, 18);
+        batch.insert(batch.end(), header, header + frame::header_size);
+        batch.insert(batch.end(), 18, 'x');
+    }
+    std::vector<char> buffer(4096);
+    std::size_t filled = 0;
+    while (std::chrono::steady_clock::now() < deadline) {
+        auto [write_ec, written] = co_await boost::asio::async_write(socket, boost::asio::buffer(batch), coro::use_task);
+        if (write_ec) co_return;
+        std::size_t responses = 0;
+        while (responses < depth) {
+            auto [read_ec, length] = co_await socket.async_read_some(
+                boost::asio::buffer(buffer.data() + filled, buffer.size() - filled), coro::use_task);
+            if (read_ec) co_return;
+            filled += length;
+            std::size_t consumed = frame::parse(buffer.data(), filled, buffer.size(),
+                [&responses](const char*, std::size_t) { ++responses; });
+            std::memmove(buffer.data(), buffer.data() + consumed, filled - consumed);
+            filled -= consumed;
+        }
+        completed += depth;
+    }
+    socket.shutdown(tcp::socket::shutdown_both, ec);
+}
+
+// Keep-alive load from many connections: `connections` client coroutines
+// spread over `threads` client threads, one io_context each. Returns
+// requests per second.
+double connection_load(unsigned short port, unsigned connections, unsigned threads, double seconds, std::size_t depth) {
+    std::atomic<std::size_t> completed{0};
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    std::vector<std::thread> clients;
+    for (unsigned t = 0; t < threads; ++t) {
+        unsigned share = connections / threads + (t < connections % threads ? 1 : 0);
+        clients.emplace_back([&completed, port, share, depth, deadline] {
+            boost::asio::io_context client_context(1);
+            std::size_t done = 0;
+            for (unsigned c = 0; c < share; ++c) {
+                coro::spawn(load_connection(client_context, port, depth, deadline, done));
+            }
+            client_context.run();
+            completed += done;
+        });
+    }
+    for (auto& client : clients) client.join();
+    return completed / seconds;
+}
+
+template<class Server>
+double measure_server(unsigned threads, double seconds) {
+    Server server(0, threads);
+    server.start();
+    double rate = exchanges_per_second(server.port(), threads, seconds);
+    server.stop();
+    return rate;
+}
+
+// Connections per second for 1, 2, 4, ... max_threads server threads. Every
+// connection carries one request, so this is also the request rate.
+void run_scaling_benchmark(unsigned max_threads, double seconds) {
+    g_log_requests = false;
+    std::cout << "Connections (= requests) per second, " << seconds << " s per point, "
+              << std::thread::hardware_concurrency() << " cores available\n";
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2) {
+        double sharded = measure_server<ShardedServer>(threads, seconds);
+        double shared = measure_server<SharedServer>(threads, seconds);
+        std::cout << "  " << threads << " threads  sharded (SO_REUSEPORT): " << static_cast<long>(sharded)
+                  << "  shared io_context + strands: " << static_cast<long>(shared) << "\n";
+    }
+}
+
+// Requests per second with connect-per-message against keep-alive
+// connections, unpipelined and with `depth` requests in flight
+void run_keep_alive_benchmark(unsigned threads, double seconds, std::size_t depth) {
+    g_log_requests = false;
+    ServerOptions keep_alive;
+    keep_alive.keep_alive = true;
+
+    double per_message = measure_server<ShardedServer>(threads, seconds);
+
+    ShardedServer server(0, threads, keep_alive);
+    server.start();
+    double unpipelined = requests_per_second(server.port(), threads, seconds, 1);
+    double pipelined = requests_per_second(server.port(), threads, seconds, depth);
+    server.stop();
+
+    std::cout << "Requests per second, " << threads << " server threads, " << threads << " clients, "
+              << seconds << " s per point, pipeline depth " << depth << ":\n"
+              << "  connect per message:       " << static_cast<long>(per_message) << "\n"
+              << "  keep-alive, 1 in flight:   " << static_cast<long>(unpipelined) << "\n"
+              << "  keep-alive, pipelined:     " << static_cast<long>(pipelined) << "\n";
+}
+
+// Requests per second for keep-alive responses carrying a `body_bytes` file,
+// written three ways: concatenated into one buffer per batch, gathered from
+// the file's mapping, and sent with sendfile
+void run_gather_benchmark(std::size_t body_bytes, double seconds, std::size_t depth) {
+    g_log_requests = false;
+    const std::string path = "/tmp/demo9_gather_body." + std::to_string(::getpid());
+    {
+        std::ofstream out(path, std::ios::binary);
+        std::string block(64 * 1024, 'x');
+        for (std::size_t left = body_bytes; left > 0;) {
+            std::size_t n = std::min(left, block.size());
+            out.write(block.data(), static_cast<std::streamsize>(n));
+            left -= n;
+        }
+    }
+    MappedFile body(path);
+
+    const std::size_t never = std::numeric_limits<std::size_t>::max();
+    struct Variant { const char* name; std::size_t copy_threshold; std::size_t sendfile_threshold; };
+    const Variant variants[] = {
+        {"copied into one buffer:  ", never, never},
+        {"gathered from mapping:   ", 0, never},
+        {"header + sendfile:       ", 0, 0},
+    };
+    std::cout << "Keep-alive responses with a " << body_bytes << "-byte file body, pipeline depth " << depth
+              << ", " << seconds << " s per point:\n";
+    for (const Variant& variant : variants) {
+        ServerOptions options;
+        options.keep_alive = true;
+        options.body = &body;
+        options.copy_threshold = variant.copy_threshold;
+        options.sendfile_threshold = variant.sendfile_threshold;
+        ShardedServer server(0, 1, options);
+        server.start();
+        double rate = requests_per_second(server.port(), 1, seconds, depth);
+        server.stop();
+        std::cout << "  " << variant.name << static_cast<long>(rate) << " req/s  "
+                  << rate * body_bytes / 1e6 << " MB/s\n";
+    }
+    std::remove(path.c_str());
+}
+
+// LoadGenerator against a one-thread keep-alive server with `options`
+LoadGenerator::Report measure_load(const ServerOptions& options, const LoadOptions& load) {
+    ShardedServer server(0, 1, options);
+    server.start();
+    boost::asio::io_context io_context;
+    tcp::resolver resolver(io_context);
+    auto endpoints = resolver.resolve("127.0.0.1", std::to_string(server.port()));
+    LoadGenerator generator(load, endpoints);
+    LoadGenerator::Report report = generator.run();
+    server.stop();
+    return report;
+}
+
+// Open-loop load from half to four times the server's capacity (measured
+// closed loop first), without limits and with every limit set: throughput,
+// latency from the due time, and how often each limit was hit
+void run_overload_benchmark(unsigned connections, double seconds, ServerOptions limited) {
+    g_log_requests = false;
+    ServerOptions unlimited;
+    unlimited.keep_alive = true;
+    limited.keep_alive = true;
+
+    LoadOptions load;
+    load.connections = connections;
+    load.threads = 1;
+    load.seconds = seconds;
+    load.depth = 64;
+    load.drain = 1;
+    double capacity = measure_load(unlimited, load).completed / seconds;
+    std::cout << "Open-loop overload, " << connections << " connections, capacity " << static_cast<long>(capacity)
+              << " req/s (closed loop, depth 64), " << seconds << " s per point\n"
+              << "Limits: max_sessions=" << limited.max_sessions << " max_in_flight=" << limited.max_in_flight
+              << " max_queued_bytes=" << limited.max_queued_bytes << "\n";
+
+    const double us = 1000.0; // Histogram values are nanoseconds
+    for (double factor : {0.5, 0.9, 1.5, 4.0}) {
+        load.rate = factor * capacity;
+        for (const ServerOptions* options : {&unlimited, &limited}) {
+            g_limits.reset();
+            LoadGenerator::Report report = measure_load(*options, load);
+            std::cout << "  offered " << factor << "x " << (options == &limited ? "limited:   " : "unlimited: ")
+                      << static_cast<long>(report.completed / report.elapsed) << " req/s  p50 "
+                      << report.latency.value_at_percentile(50) / us << " us  p99 "
+                      << report.latency.value_at_percentile(99) / us << " us  timed out " << report.timed_out
+                      << "  pauses: accept " << g_limits.accept_pauses << ", in-flight " << g_limits.in_flight_pauses
+                      << ", queued bytes " << g_limits.queued_bytes_pauses << "\n";
+        }
+    }
+}
+
+// Per-connection timeouts with `connections` connections, each doing `rounds`
+// reads: before a read its timeout is armed, when the read completes it is
+// cancelled. One steady_timer per connection (an operation allocated and a
+// deadline pushed onto Asio's timer heap per read, a posted completion per
+// cancel) against one TimingWheel. Then a live check that idle keep-alive
+// connections are closed by idle_timeout.
+void run_timer_benchmark(std::size_t connections, int rounds) {
+    g_log_requests = false;
+    using clock = std::chrono::steady_clock;
+    const auto timeout = std::chrono::seconds(30);
+    auto ns_per_read = [&](clock::duration elapsed) {
+        return std::chrono::duration<double, std::nano>(elapsed).count() / (static_cast<double>(connections) * rounds);
+    };
+    auto allocations_per_read = [&](std::size_t allocations) {
+        return static_cast<double>(allocations) / (static_cast<double>(connections) * rounds);
+    };
+
+    boost::asio::io_context io_context(1);
+    std::size_t aborted = 0;
+    std::vector<boost::asio::steady_timer> steady_timers;
+    steady_timers.reserve(connections);
+    for (std::size_t i = 0; i < connections; ++i) steady_timers.emplace_back(io_context);
+    std::size_t before = t_allocations;
+    auto start = clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        for (auto& timer : steady_timers) {
+            timer.expires_after(timeout);
+            timer.async_wait([&aborted](boost::system::error_code ec) { if (ec) ++aborted; });
+        }
+        for (auto& timer : steady_timers) timer.cancel();
+        io_context.restart();
+        io_context.poll(); // Runs the cancelled waits' handlers
+    }
+    auto steady_elapsed = clock::now() - start;
+    std::size_t steady_allocations = t_allocations - before;
+    steady_timers.clear();
+
+    TimingWheel wheel(io_context);
+    std::deque<TimingWheel::Timer> wheel_timers;
+    for (std::size_t i = 0; i < connections; ++i) wheel_timers.emplace_back([](void*) {}, nullptr);
+    before = t_allocations;
+    start = clock::now();
+    for (int round = 0; round < rounds; ++round) {
+        for (auto& timer : wheel_timers) wheel.arm(timer, timeout);
+        for (auto& timer : wheel_timers) timer.cancel();
+    }
+    auto wheel_elapsed = clock::now() - start;
+    std::size_t wheel_allocations = t_allocations - before;
+
+    std::cout << "Timeout arm + cancel per read, " << connections << " connections, " << rounds << " reads each:\n"
+              << "  steady_timer per connection: " << ns_per_read(steady_elapsed) << " ns, "
+              << allocations_per_read(steady_allocations) << " allocations, " << sizeof(boost::asio::steady_timer)
+              << " bytes per connection\n"
+              << "  timing wheel:                " << ns_per_read(wheel_elapsed) << " ns, "
+              << allocations_per_read(wheel_allocations) << " allocations, " << sizeof(TimingWheel::Timer)
+              << " bytes per connection\n";
+
+    // Idle connections are closed once idle_timeout passes
+    ServerOptions options;
+    options.keep_alive = true;
+    options.idle_timeout = std::chrono::milliseconds(100);
+    boost::asio::io_context server_context(1);
+    TcpServer server(server_context, 0, options);
+    std::thread server_thread([&server_context] { server_context.run(); });
+    const std::size_t idle = std::min<std::size_t>(connections, 2000);
+    boost::asio::io_context client_context;
+    std::vector<tcp::socket> sockets;
+    for (std::size_t i = 0; i < idle; ++i) {
+        sockets.emplace_back(client_context);
+        sockets.back().connect(tcp::endpoint(boost::asio::ip::address_v4::loopback(), server.port()));
+    }
+    auto opened = clock::now();
+    std::size_t closed = 0;
+    for (auto& socket : sockets) {
+        char byte;
+        boost::system::error_code ec;
+        socket.read_some(boost::asio::buffer(&byte, 1), ec);
+        if (ec == boost::asio::error::eof || ec == boost::asio::error::connection_reset) ++closed;
+    }
+    double waited_ms = std::chrono::duration<double, std::milli>(clock::now() - opened).count();
+    server_context.stop();
+    server_thread.join();
+    std::cout << "Idle timeout 100 ms: " << closed << " of " << idle << " idle connections closed by the server after "
+              << waited_ms << " ms (" << g_timeouts.idle << " idle timeouts)\n";
+}
+
+// Datagram round trips per second against a UdpServer: one client thread
+// sends `window` requests and collects their responses, `batch` per sendmmsg /
+// recvmmsg. A response lost for 100 ms is given up on.
+double datagrams_per_second(unsigned short port, std::size_t batch, std::size_t window, double seconds) {
+    boost::asio::io_context client_context;
+    udp::socket socket(client_context);
+    socket.connect(udp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+    int fd = socket.native_handle();
+    timeval timeout{0, 100 * 1000};
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    static constexpr char msg[] = "Hello from client!";
+    iovec request{const_cast<char*>(msg), sizeof(msg) - 1};
+    std::vector<char> replies(batch * 64);
+    std::vector<iovec> reply_iovecs(batch);
+    std::vector<mmsghdr> requests(batch), responses(batch);
+    for (std::size_t i = 0; i < batch; ++i) {
+        requests[i].msg_hdr.msg_iov = &request;
+        requests[i].msg_hdr.msg_iovlen = 1;
+        reply_iovecs[i] = {replies.data() + i * 64, 64};
+        responses[i].msg_hdr.msg_iov = &reply_iovecs[i];
+        responses[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    std::size_t done = 0;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(seconds);
+    while (std::chrono::steady_clock::now() < deadline) {
+        std::size_t sent = 0;
+        while (sent < window) {
+            int n = ::sendmmsg(fd, requests.data(), static_cast<unsigned>(std::min(batch, window - sent)), 0);
+            if (n <= 0) break;
+            sent += static_cast<std::size_t>(n);
+        }
+        for (std::size_t received = 0; received < sent;) {
+            int n = ::recvmmsg(fd, responses.data(), static_cast<unsigned>(std::min(batch, sent - received)),
+                               MSG_WAITFORONE, nullptr);
+            if (n <= 0) break; // Timed out: the rest were dropped
+            received += static_cast<std::size_t>(n);
+            done += static_cast<std::size_t>(n);
+        }
+    }
+    return done / seconds;
+}
+
+// The effect of each SocketTuning setting on loopback, the same setting on
+// both ends: one connection with one request in flight (latency), 64
+// connections with 16 each (throughput), and connect-per-message exchanges.
+// Then the UDP variant with one datagram per syscall against batches.
+void run_tuning_benchmark(double seconds) {
+    g_log_requests = false;
+    struct Variant { const char* name; SocketTuning tuning; };
+    std::vector<Variant> variants;
+    variants.push_back({"defaults (TCP_NODELAY)", {}});
+    variants.push_back({"no_delay=0 (Nagle)    ", {}});
+    variants.back().tuning.no_delay = false;
+    variants.push_back({"quick_ack=1           ", {}});
+    variants.back().tuning.quick_ack = true;
+    variants.push_back({"buffers 16 KiB        ", {}});
+    variants.back().tuning.send_buffer = variants.back().tuning.receive_buffer = 16 * 1024;
+    variants.push_back({"buffers 4 MiB         ", {}});
+    variants.back().tuning.send_buffer = variants.back().tuning.receive_buffer = 4 * 1024 * 1024;
+    variants.push_back({"busy_poll=50          ", {}});
+    variants.back().tuning.busy_poll_us = 50;
+    variants.push_back({"defer_accept=1        ", {}});
+    variants.back().tuning.defer_accept_s = 1;
+
+    const double us = 1000.0; // Histogram values are nanoseconds
+    std::cout << "Socket settings on loopback, " << seconds << " s per point:\n"
+              << "  setting                  1 conn x 1: req/s   p50 us   p99 us | 64 conns x 16: req/s | connect/s\n";
+    for (const Variant& variant : variants) {
+        ServerOptions options;
+        options.keep_alive = true;
+        options.socket = variant.tuning;
+        LoadOptions load;
+        load.threads = 1;
+        load.seconds = seconds;
+        load.drain = 1;
+        load.socket = variant.tuning;
+        load.connections = 1;
+        load.depth = 1;
+        LoadGenerator::Report latency = measure_load(options, load);
+        load.connections = 64;
+        load.depth = 16;
+        LoadGenerator::Report throughput = measure_load(options, load);
+
+        options.keep_alive = false;
+        ShardedServer server(0, 1, options);
+        server.start();
+        double connects = exchanges_per_second(server.port(), 1, seconds);
+        server.stop();
+
+        std::cout << "  " << variant.name << "  " << static_cast<long>(latency.completed / latency.elapsed) << "   "
+                  << latency.latency.value_at_percentile(50) / us << "   " << latency.latency.value_at_percentile(99) / us
+                  << " | " << static_cast<long>(throughput.completed / throughput.elapsed) << " | "
+                  << static_cast<long>(connects) << "\n";
+    }
+
+    std::cout << "UDP round trips per second, 64 outstanding:\n";
+    for (std::size_t batch : {1, 8, 32}) {
+        ServerOptions options;
+        options.udp_batch = batch;
+        boost::asio::io_context io_context(1);
+        UdpServer server(io_context, 0, options);
+        std::thread server_thread([&io_context] { io_context.run(); });
+        double rate = datagrams_per_second(server.port(), batch, 64, seconds);
+        io_context.stop();
+        server_thread.join();
+        std::cout << "  " << batch << " datagrams per recvmmsg / sendmmsg: " << static_cast<long>(rate) << "\n";
+    }
+}
+
+// Cost on the I/O thread of logging `messages` requests, in bursts of 256 as
+// a keep-alive batch would log them: std::cout-style stream output with
+// std::endl against the async logger, both writing to /dev/null. The
+// logger's time covers the calls only; its writer formats and writes on its
+// own thread, and is waited for between bursts.
+void run_logging_benchmark(int messages) {
+    using clock = std::chrono::steady_clock;
+    const int burst = 256;
+    const std::string_view payload = "Hello from client!";
+
+    std::ofstream stream("/dev/null");
+    auto start = clock::now();
+    for (int i = 0; i < messages; ++i) stream << "Received: " << std::string(payload) << std::endl;
+    double stream_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / messages;
+
+    int null_fd = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    alog::Logger::instance().set_fd(null_fd);
+    alog::flush(); // Starts the writer and registers this thread outside the measurement
+    clock::duration in_calls{};
+    start = clock::now();
+    for (int done = 0; done < messages; done += burst) {
+        auto calls = clock::now();
+        for (int i = 0; i < burst; ++i) alog::info("Received: ", payload);
+        in_calls += clock::now() - calls;
+        alog::flush();
+    }
+    double total_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count() / messages;
+    double logger_ns = std::chrono::duration<double, std::nano>(in_calls).count() / messages;
+    alog::Logger::instance().set_fd(STDOUT_FILENO);
+    ::close(null_fd);
+
+    std::cout << "Logging " << messages << " requests, bursts of " << burst << ", to /dev/null:\n"
+              << "  stream << std::string << std::endl:  " << stream_ns << " ns per request on the I/O thread\n"
+              << "  alog::info:                          " << logger_ns << " ns per request on the I/O thread, "
+              << total_ns << " ns including the writer (one write() per burst)\n";
+}
+
+// Applies and removes key=value option arguments (max_sessions=N,
+// idle_timeout=ms, no_delay=0 and so on) from argv; false if one is not
+// recognised
+bool parse_options(int& argc, char* argv[], ServerOptions& options) {
+    int kept = 1;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        if (eq == std::string::npos) {
+            argv[kept++] = argv[i];
+            continue;
+        }
+        std::string key = arg.substr(0, eq);
+        std::size_t value = std::strtoull(arg.c_str() + eq + 1, nullptr, 10);
+        if (key == "max_sessions") options.max_sessions = value;
+        else if (key == "max_in_flight") options.max_in_flight = value;
+        else if (key == "max_queued_bytes") options.max_queued_bytes = value;
+        else if (key == "idle_timeout") options.idle_timeout = std::chrono::milliseconds(value);
+        else if (key == "read_timeout") options.read_timeout = std::chrono::milliseconds(value);
+        else if (key == "write_timeout") options.write_timeout = std::chrono::milliseconds(value);
+        else if (key == "udp_batch") options.udp_batch = value;
+        else if (!parse_socket_option(key, static_cast<long>(value), options.socket)) return false;
+    }
+    argc = kept;
+    return true;
+}
+
+#ifdef WITH_IO_URING
+template<class Server>
+double measure_connection_load(unsigned threads, unsigned connections, double seconds, std::size_t depth,
+                               ServerOptions options, UringOptions uring = {}) {
+    std::unique_ptr<Server> server;
+    if constexpr (std::is_same_v<Server, UringServer>) {
+        server = std::make_unique<Server>(0, threads, options, uring);
+    } else {
+        server = std::make_unique<Server>(0, threads, options);
+    }
+    server->start();
+    double rate = connection_load(server->port(), connections, threads, seconds, depth);
+    server->stop();
+    return rate;
+}
+
+// Asio's epoll reactor against io_uring, both sharded the same way: keep-alive
+// requests/s with many open connections, then connect-per-message exchanges/s
+void run_uring_benchmark(unsigned connections, double seconds, std::size_t depth, unsigned threads) {
+    g_log_requests = false;
+    ServerOptions keep_alive;
+    keep_alive.keep_alive = true;
+    UringOptions sqpoll;
+    sqpoll.sqpoll = true;
+
+    double asio = measure_connection_load<ShardedServer>(threads, connections, seconds, depth, keep_alive);
+    double uring = measure_connection_load<UringServer>(threads, connections, seconds, depth, keep_alive);
+    double uring_sqpoll = measure_connection_load<UringServer>(threads, connections, seconds, depth, keep_alive, sqpoll);
+    std::cout << "Keep-alive requests per second, " << connections << " connections, pipeline depth " << depth
+              << ", " << threads << " server threads, " << seconds << " s per point:\n"
+              << "  Asio (epoll):        " << static_cast<long>(asio) << "\n"
+              << "  io_uring:            " << static_cast<long>(uring) << "\n"
+              << "  io_uring + SQPOLL:   " << static_cast<long>(uring_sqpoll) << "\n";
+
+    double asio_connect = measure_server<ShardedServer>(threads, seconds);
+    double uring_connect = measure_server<UringServer>(threads, seconds);
+    std::cout << "Connect per message, exchanges per second:\n"
+              << "  Asio (epoll):        " << static_cast<long>(asio_connect) << "\n"
+              << "  io_uring:            " << static_cast<long>(uring_connect) << "\n";
+}
+#endif
+
 int main(int argc, char* argv[]) {
     try {
-        if (argc != 2) { // Check if the port number is provided
-            std::cerr << "Usage: TcpServer <port>\n";
+        ServerOptions options;
+        if (!parse_options(argc, argv, options)) {
+            std::cerr << "Unknown option; limits are max_sessions=N max_in_flight=N max_queued_bytes=N,\n"
+                      << "timeouts (ms) idle_timeout=N read_timeout=N write_timeout=N, socket options\n"
+                      << "no_delay=0|1 send_buffer=N receive_buffer=N quick_ack=0|1 busy_poll=us defer_accept=s,\n"
+                      << "udp_batch=N\n";
+            return 1;
+        }
+        if (argc >= 2 && std::string(argv[1]) == "bench") {
+            run_benchmark(argc >= 3 ? std::atoi(argv[2]) : 2000);
+            return 0;
+        }
+        if (argc >= 2 && std::string(argv[1]) == "alloc") {
+            double per_request = allocations_per_keep_alive_request(argc >= 3 ? std::atoi(argv[2]) : 10000);
+            std::cout << "Server-thread heap allocations per keep-alive request: " << per_request << std::endl;
+            return per_request == 0 ? 0 : 1;
+        }
+        if (argc >= 2 && std::string(argv[1]) == "scale") {
+            run_scaling_benchmark(argc >= 3 ? std::atoi(argv[2]) : 32, argc >= 4 ? std::atof(argv[3]) : 1.0);
+            return 0;
+        }
+        if (argc >= 2 && std::string(argv[1]) == "gather") {
+            run_gather_benchmark(argc >= 3 ? std::atol(argv[2]) : 256 * 1024, argc >= 4 ? std::atof(argv[3]) : 1.0,
+                                 argc >= 5 ? std::atoi(argv[4]) : 4);
+            return 0;
+        }
+#ifdef WITH_IO_URING
+        if (argc >= 2 && std::string(argv[1]) == "uring") {
+            run_uring_benchmark(argc >= 3 ? std::atoi(argv[2]) : 1000, argc >= 4 ? std::atof(argv[3]) : 1.0,
+                                argc >= 5 ? std::atoi(argv[4]) : 1, argc >= 6 ? std::atoi(argv[5]) : 1);
+            return 0;
+        }
+#endif
+        if (argc >= 2 && std::string(argv[1]) == "overload") {
+            if (options.max_sessions == 0) options.max_sessions = argc >= 4 ? std::atoi(argv[3]) : 256;
+            if (options.max_in_flight == 0) options.max_in_flight = 64;
+            if (options.max_queued_bytes == 0) options.max_queued_bytes = 64 * 1024;
+            run_overload_benchmark(argc >= 4 ? std::atoi(argv[3]) : 256, argc >= 3 ? std::atof(argv[2]) : 1.0, options);
+            return 0;
+        }
+        if (argc >= 2 && std::string(argv[1]) == "tuning") {
+            run_tuning_benchmark(argc >= 3 ? std::atof(argv[2]) : 1.0);
+            return 0;
+        }
+        if (argc == 3 && std::string(argv[2]) == "udp") { // The one-shot protocol over UDP
+            boost::asio::io_context io_context(1);
+            UdpServer server(io_context, static_cast<unsigned short>(std::atoi(argv[1])), options);
+            io_context.run();
+            return 0;
+        }
+        if (argc >= 2 && std::string(argv[1]) == "logging") {
+            run_logging_benchmark(argc >= 3 ? std::atoi(argv[2]) : 1000000);
+            return 0;
+        }
+        if (argc >= 2 && std::string(argv[1]) == "timers") {
+            run_timer_benchmark(argc >= 3 ? std::atol(argv[2]) : 100000, argc >= 4 ? std::atoi(argv[3]) : 20);
+            return 0;
+        }
+        if (argc >= 2 && std::string(argv[1]) == "keepalive") {
+            run_keep_alive_benchmark(argc >= 3 ? std::atoi(argv[2]) : 1, argc >= 4 ? std::atof(argv[3]) : 1.0,
+                                     argc >= 5 ? std::atoi(argv[4]) : 16);
+            return 0;
+        }
+
+        std::optional<MappedFile> body;
+        if (argc >= 4 && std::string(argv[argc - 2]) == "keepalive") { // keepalive <file>: serve the file's contents
+            body.emplace(argv[argc - 1]);
+            if (body->size() > std::numeric_limits<std::uint32_t>::max()) {
+                std::cerr << "File too large for a frame: " << argv[argc - 1] << "\n";
+                return 1;
+            }
+            options.body = &*body;
+            --argc;
+        }
+        if (argc >= 3 && std::string(argv[argc - 1]) == "keepalive") { // Trailing flag: length-prefixed keep-alive
+            options.keep_alive = true;
+            --argc;
+        }
+        if (argc < 2 || argc > 4) { // Check if the port number is provided
+            std::cerr << "Usage: TcpServer <port> [threads [sharded|shared|uring|sqpoll]] [keepalive [file]]\n"
+                      << "                 [max_sessions=N] [max_in_flight=N] [max_queued_bytes=N]\n"
+                      << "                 [idle_timeout=ms] [read_timeout=ms] [write_timeout=ms]\n"
+                      << "                 [no_delay=0|1] [send_buffer=N] [receive_buffer=N] [quick_ack=0|1]\n"
+                      << "                 [busy_poll=us] [defer_accept=s]\n"
+                      << "       TcpServer <port> udp [udp_batch=N]\n"
+                      << "       TcpServer bench [connections]\n"
+                      << "       TcpServer scale [max_threads [seconds]]\n"
+                      << "       TcpServer keepalive [threads [seconds [depth]]]\n"
+                      << "       TcpServer gather [body_bytes [seconds [depth]]]\n"
+                      << "       TcpServer uring [connections [seconds [depth [threads]]]]\n"
+                      << "       TcpServer overload [seconds [connections]] [max_...=N]\n"
+                      << "       TcpServer timers [connections [rounds]]\n"
+                      << "       TcpServer tuning [seconds]\n"
+                      << "       TcpServer logging [messages]\n";
             return 1;
         }
 
+        unsigned short port = static_cast<unsigned short>(std::atoi(argv[1]));
+        if (argc >= 3) { // Multi-threaded: one shard per thread, or one shared io_context
+            unsigned threads = static_cast<unsigned>(std::atoi(argv[2]));
+            std::string layout = argc == 4 ? argv[3] : "sharded";
+#ifdef WITH_IO_URING
+            if (layout == "uring" || layout == "sqpoll") { // Same protocol on io_uring rings
+                if (options.body) {
+                    std::cerr << "The io_uring server only serves the greeting\n";
+                    return 1;
+                }
+                if (options.max_sessions || options.max_in_flight || options.max_queued_bytes || options.has_timeouts()) {
+                    std::cerr << "The io_uring server has no backpressure limits or timeouts\n";
+                    return 1;
+                }
+                UringOptions uring;
+                uring.sqpoll = layout == "sqpoll";
+                UringServer server(port, threads, options, uring);
+                server.start();
+                server.join();
+                return 0;
+            }
+#endif
+            if (layout == "shared") {
+                SharedServer server(port, threads, options);
+                server.start();
+                server.join();
+            } else {
+                ShardedServer server(port, threads, options);
+                server.start();
+                server.join();
+            }
+            return 0;
+        }
+
         boost::asio::io_context io_context; // Create an IO context
-        TcpServer server(io_context, std::atoi(argv[1])); // Create a server with the specified port
+        TcpServer server(io_context, port, options); // Create a server with the specified port
         io_context.run(); // Run the IO context to start handling events
     } catch (std::exception& e) { // Catch any exceptions
         std::cerr << "Exception: " << e.what() << "\n";
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+// Ways of moving a file's bytes, from cheapest to most expensive. Each one
+// works on the descriptors' current offsets, so a copy can switch to the next
+// strategy part-way through and carry on where the last one stopped.
+enum class Transfer {
+    reflink, // FICLONE: the destination shares the source's extents (btrfs, XFS with reflink, ...); no data moves
+    copy_file_range, // The kernel copies between the files (and may offload or share extents itself)
+    splice, // Page references go through a pipe, never through a user-space buffer
+    buffered, // read() into a buffer and write() it out
+};
+
+inline const char* transfer_name(Transfer transfer) {
+    switch (transfer) {
+    case Transfer::reflink: return "reflink";
+    case Transfer::copy_file_range: return "copy_file_range";
+    case Transfer::splice: return "splice";
+    case Transfer::buffered: return "buffered";
+    }
+    return "?";
+}
+
+inline bool parse_transfer(const std::string& name, Transfer& transfer) {
+    for (Transfer t : {Transfer::reflink, Transfer::copy_file_range, Transfer::splice, Transfer::buffered}) {
+        if (name == transfer_name(t)) {
+            transfer = t;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline Transfer next_transfer(Transfer transfer) {
+    return transfer == Transfer::buffered ? transfer : static_cast<Transfer>(static_cast<int>(transfer) + 1);
+}
+
+// Errors that mean "not for these files" (another filesystem, no support in
+// this kernel or filesystem) rather than a failed copy
+inline bool transfer_unsupported(int error) {
+    return error == EXDEV || error == EINVAL || error == ENOSYS || error == EOPNOTSUPP || error == ENOTTY ||
+           error == EBADF;
+}
+
+// Clone the whole of `in` into `out` (which should be empty); false with errno set if the filesystem cannot
+inline bool reflink(int in, int out) {
+    return ::ioctl(out, FICLONE, in) == 0;
+}
+
+// Copy up to `length` bytes with copy_file_range; bytes copied, 0 at the end of input, -1 with errno
+inline ssize_t copy_range_step(int in, int out, std::size_t length) {
+    return ::copy_file_range(in, nullptr, out, nullptr, length, 0);
+}
+
+// A pipe for moving file data with splice(): file -> pipe -> file
+class SplicePipe {
+public:
+    explicit SplicePipe(std::size_t capacity) {
+        if (::pipe2(fds_, O_CLOEXEC) != 0) return;
+        ::fcntl(fds_[1], F_SETPIPE_SZ, static_cast<int>(capacity)); // Best effort: capped by /proc/sys/fs/pipe-max-size
+        capacity_ = static_cast<std::size_t>(std::max(::fcntl(fds_[1], F_GETPIPE_SZ), 0));
+    }
+
+    SplicePipe(const SplicePipe&) = delete;
+    SplicePipe& operator=(const SplicePipe&) = delete;
+
+    ~SplicePipe() {
+        if (fds_[0] >= 0) ::close(fds_[0]);
+        if (fds_[1] >= 0) ::close(fds_[1]);
+    }
+
+    bool valid() const { return capacity_ > 0; }
+
+    // Move up to `length` bytes (at most a pipe's worth) from `in` to `out`;
+    // bytes moved, 0 at the end of input, -1 with errno. Whatever enters the
+    // pipe leaves it before returning, so the next step, or another
+    // strategy, starts with it empty. An output that refuses splice (say, a
+    // device without splice_write) is only found out once the pipe is full:
+    // those bytes are then written out with write(), and the next step
+    // fails with the refusal's errno so the caller can fall back.
+    ssize_t step(int in, int out, std::size_t length) {
+        if (!valid()) {
+            errno = ENOSYS;
+            return -1;
+        }
+        if (refused_) {
+            errno = refused_;
+            return -1;
+        }
+        ssize_t filled = ::splice(in, nullptr, fds_[1], nullptr, std::min(length, capacity_), SPLICE_F_MOVE);
+        if (filled <= 0) return filled;
+        for (ssize_t left = filled; left > 0;) {
+            ssize_t n = ::splice(fds_[0], nullptr, out, nullptr, static_cast<std::size_t>(left), SPLICE_F_MOVE);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && transfer_unsupported(errno)) {
+                refused_ = errno;
+                return drain(out, static_cast<std::size_t>(left)) ? filled : -1;
+            }
+            if (n <= 0) { // Bytes stuck in the pipe: report a real failure, not one to fall back from
+                if (n == 0) errno = EIO;
+                return -1;
+            }
+            left -= n;
+        }
+        return filled;
+    }
+
+private:
+    // Copy the `left` bytes in the pipe to `out` with read() and write(); false with errno
+    bool drain(int out, std::size_t left) {
+        std::vector<char> buffer(std::min<std::size_t>(left, 64 * 1024));
+        while (left > 0) {
+            ssize_t got = ::read(fds_[0], buffer.data(), std::min(left, buffer.size()));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) {
+                if (got == 0) errno = EIO;
+                return false;
+            }
+            for (ssize_t done = 0; done < got;) {
+                ssize_t n = ::write(out, buffer.data() + done, static_cast<std::size_t>(got - done));
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    if (n == 0) errno = EIO;
+                    return false;
+                }
+                done += n;
+            }
+            left -= static_cast<std::size_t>(got);
+        }
+        return true;
+    }
+
+    int fds_[2] = {-1, -1};
+    std::size_t capacity_ = 0;
+    int refused_ = 0; // errno of the output's refusal to splice, reported by the next step
+};
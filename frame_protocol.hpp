@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// Wire format for keep-alive connections in the TCP demos: every message is a
+// 4-byte big-endian payload length followed by the payload. Several messages
+// may arrive in one read (pipelining) and one message may span several reads.
+namespace frame {
+
+constexpr std::size_t header_size = 4;
+constexpr std::size_t invalid = static_cast<std::size_t>(-1); // Returned by parse() for an oversized frame
+
+inline void write_header(unsigned char* out, std::uint32_t length) {
+    out[0] = static_cast<unsigned char>(length >> 24);
+    out[1] = static_cast<unsigned char>(length >> 16);
+    out[2] = static_cast<unsigned char>(length >> 8);
+    out[3] = static_cast<unsigned char>(length);
+}
+
+inline std::uint32_t read_header(const unsigned char* in) {
+    return (std::uint32_t(in[0]) << 24) | (std::uint32_t(in[1]) << 16) |
+           (std::uint32_t(in[2]) << 8) | std::uint32_t(in[3]);
+}
+
+// Bytes needed to hold the whole frame that starts at `data`: header plus
+// payload, or just header_size while the header itself is incomplete.
+// Lets a reader grow its buffer for frames larger than it.
+inline std::size_t frame_size(const char* data, std::size_t size) {
+    if (size < header_size) return header_size;
+    return header_size + read_header(reinterpret_cast<const unsigned char*>(data));
+}
+
+// Call on_frame(payload, size) for every complete frame at the start of
+// [data, data + size). Returns the number of bytes consumed; the rest is an
+// incomplete frame to be kept until more bytes arrive. Returns `invalid` if a
+// frame announces more than max_payload bytes.
+//
+// With max_frames, stop after that many frames even if more are complete, so
+// a reader can bound the work it takes on per read (see has_frame()).
+template<class OnFrame>
+std::size_t parse(const char* data, std::size_t size, std::size_t max_payload, std::size_t max_frames, OnFrame&& on_frame) {
+    std::size_t consumed = 0;
+    for (std::size_t frames = 0; frames < max_frames && size - consumed >= header_size; ++frames) {
+        std::uint32_t length = read_header(reinterpret_cast<const unsigned char*>(data + consumed));
+        if (length > max_payload) return invalid;
+        if (size - consumed - header_size < length) break;
+        on_frame(data + consumed + header_size, static_cast<std::size_t>(length));
+        consumed += header_size + length;
+    }
+    return consumed;
+}
+
+template<class OnFrame>
+std::size_t parse(const char* data, std::size_t size, std::size_t max_payload, OnFrame&& on_frame) {
+    return parse(data, size, max_payload, static_cast<std::size_t>(-1), std::forward<OnFrame>(on_frame));
+}
+
+// True if [data, data + size) starts with a complete frame
+inline bool has_frame(const char* data, std::size_t size) {
+    return size >= header_size && frame_size(data, size) <= size;
+}
+
+}  // namespace frame
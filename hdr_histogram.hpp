@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+#include <vector>
+
+// Latency histogram in the style of HdrHistogram: every power-of-two range of
+// values is split into the same number of linear sub-buckets, so any recorded
+// value is kept to within 1/1024 of itself (three significant digits) from
+// nanoseconds up to minutes, in a fixed 256 KiB of counters. Recording is an
+// index computation and an increment, cheap enough for every request.
+//
+// Values are unitless (the load generator records nanoseconds). Percentiles
+// are reported as the highest value equivalent to the bucket they fall in,
+// so they never understate a latency.
+class HdrHistogram {
+public:
+    static constexpr int sub_bucket_bits = 11;
+    static constexpr std::uint64_t highest_trackable = (std::uint64_t(1) << 40) - 1; // ~18 minutes in ns; larger values are clamped
+
+    HdrHistogram() : counts_(index_of(highest_trackable) + 1) {}
+
+    void record(std::uint64_t value, std::uint64_t count = 1) {
+        value = std::min(value, highest_trackable);
+        counts_[index_of(value)] += count;
+        total_ += count;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+        sum_ += static_cast<double>(value) * static_cast<double>(count);
+    }
+
+    // Record `value` for a sampler that meant to issue one request every
+    // `expected_interval`. A stall longer than that also delayed the requests
+    // the sampler never got to send; they are added as the values they would
+    // have seen (value - interval, value - 2 * interval, ...), which undoes
+    // coordinated omission in closed-loop measurements.
+    void record_corrected(std::uint64_t value, std::uint64_t expected_interval, std::uint64_t count = 1) {
+        record(value, count);
+        if (expected_interval == 0) return;
+        for (std::uint64_t missing = value; missing > expected_interval;) {
+            missing -= expected_interval;
+            record(missing, count);
+        }
+    }
+
+    // A copy of this histogram as if every value had gone through record_corrected
+    HdrHistogram corrected(std::uint64_t expected_interval) const {
+        HdrHistogram result;
+        for (std::size_t i = 0; i < counts_.size(); ++i) {
+            if (counts_[i]) result.record_corrected(highest_equivalent(i), expected_interval, counts_[i]);
+        }
+        return result;
+    }
+
+    void merge(const HdrHistogram& other) {
+        for (std::size_t i = 0; i < counts_.size(); ++i) counts_[i] += other.counts_[i];
+        total_ += other.total_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+        sum_ += other.sum_;
+    }
+
+    std::uint64_t count() const { return total_; }
+    std::uint64_t min() const { return total_ ? min_ : 0; }
+    std::uint64_t max() const { return max_; }
+    double mean() const { return total_ ? sum_ / static_cast<double>(total_) : 0.0; }
+
+    // Smallest recorded value (to histogram precision) that at least
+    // `percentile` percent of all values do not exceed
+    std::uint64_t value_at_percentile(double percentile) const {
+        if (total_ == 0) return 0;
+        auto target = static_cast<std::uint64_t>(std::ceil(percentile / 100.0 * static_cast<double>(total_)));
+        target = std::clamp<std::uint64_t>(target, 1, total_);
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= target) return std::min(highest_equivalent(i), max_);
+        }
+        return max_;
+    }
+
+    // p50 ... max in `unit`s (e.g. 1000 to print nanoseconds as microseconds)
+    void print_summary(std::ostream& out, double unit) const {
+        out << "p50 " << value_at_percentile(50) / unit << "  p90 " << value_at_percentile(90) / unit
+            << "  p99 " << value_at_percentile(99) / unit << "  p99.9 " << value_at_percentile(99.9) / unit
+            << "  p99.99 " << value_at_percentile(99.99) / unit << "  max " << max_ / unit
+            << "  mean " << mean() / unit;
+    }
+
+    // The same figures as a JSON object
+    void write_json(std::ostream& out, double unit) const {
+        out << "{\"count\": " << total_ << ", \"min\": " << min() / unit << ", \"mean\": " << mean() / unit
+            << ", \"p50\": " << value_at_percentile(50) / unit << ", \"p90\": " << value_at_percentile(90) / unit
+            << ", \"p99\": " << value_at_percentile(99) / unit << ", \"p99.9\": " << value_at_percentile(99.9) / unit
+            << ", \"p99.99\": " << value_at_percentile(99.99) / unit << ", \"max\": " << max_ / unit << "}";
+    }
+
+private:
+    static constexpr std::uint64_t sub_bucket_count = std::uint64_t(1) << sub_bucket_bits;
+    static constexpr std::uint64_t sub_bucket_half = sub_bucket_count / 2;
+
+    // Values below sub_bucket_count map to themselves. Above that, a value
+    // with its top bit at position sub_bucket_bits - 1 + e keeps its top
+    // sub_bucket_bits bits: index = e * half + (value >> e).
+    static std::size_t index_of(std::uint64_t value) {
+        if (value < sub_bucket_count) return static_cast<std::size_t>(value);
+        int exponent = std::bit_width(value) - sub_bucket_bits;
+        return static_cast<std::size_t>(exponent * sub_bucket_half + (value >> exponent));
+    }
+
+    static std::uint64_t lowest_equivalent(std::size_t index) {
+        if (index < sub_bucket_count) return index;
+        std::uint64_t exponent = index / sub_bucket_half - 1;
+        return (index - exponent * sub_bucket_half) << exponent;
+    }
+
+    static std::uint64_t highest_equivalent(std::size_t index) { return lowest_equivalent(index + 1) - 1; }
+
+    std::vector<std::uint64_t> counts_;
+    std::uint64_t total_ = 0;
+    std::uint64_t min_ = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t max_ = 0;
+    double sum_ = 0.0;
+};
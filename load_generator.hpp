@@ -0,0 +1,367 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/asio.hpp>
+
+#include "coro_asio.hpp"
+#include "frame_protocol.hpp"
+#include "hdr_histogram.hpp"
+#include "socket_tuning.hpp"
+
+// Settings for LoadGenerator, given on the command line as key=value
+struct LoadOptions {
+    unsigned connections = 100; // Concurrent keep-alive connections
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency()); // Client threads, one io_context each
+    double seconds = 10; // Length of the measured run
+    double rate = 0; // Open loop: requests per second over all connections. 0 = closed loop
+    std::size_t depth = 1; // Closed loop: requests kept in flight per connection
+    std::size_t size = 18; // Request payload bytes
+    double drain = 2; // Seconds to wait for outstanding responses after the run
+    double expected = 0; // Closed loop: intended microseconds between a connection's requests, for the correction
+    bool json = false; // Print the report as one JSON object
+    SocketTuning socket; // Applied to every connection once it is open
+};
+
+// Drives a keep-alive server (demo9_async_tcp_server <port> keepalive) with
+// many concurrent connections spread over several threads.
+//
+// Closed loop: every connection keeps `depth` requests in flight and sends a
+// new one for each response. The measured latencies suffer from coordinated
+// omission (a stalled server also stops the requests that would have seen
+// the stall); given the interval at which requests were meant to go out
+// (expected=us), the report adds a histogram corrected for it.
+//
+// Open loop: requests are due at a fixed total rate whatever the server does;
+// each connection sends every connections / rate seconds, sending all overdue
+// requests at once when it falls behind. Latency runs from the time a
+// request was due, not from when it could actually be sent, so stalls are
+// charged in full.
+class LoadGenerator {
+public:
+    using tcp = boost::asio::ip::tcp;
+    using clock = std::chrono::steady_clock;
+
+    struct Report {
+        HdrHistogram latency; // Nanoseconds
+        std::size_t completed = 0;
+        std::size_t timed_out = 0; // Still unanswered after the drain period
+        std::size_t failed_connections = 0; // Refused, or reset during the run
+        double elapsed = 0; // Seconds from the start to the last response (at least the run length)
+    };
+
+    LoadGenerator(const LoadOptions& options, const tcp::resolver::results_type& endpoints)
+        : options_(options) {
+        for (unsigned t = 0; t < options.threads; ++t) {
+            unsigned share = options.connections / options.threads + (t < options.connections % options.threads ? 1 : 0);
+            workers_.push_back(std::make_unique<Worker>(options_, endpoints, share));
+        }
+    }
+
+    Report run() {
+        // Connect everything first, so that setup is not part of the measurement
+        std::vector<std::thread> threads;
+        for (auto& worker : workers_) threads.emplace_back([&worker] { worker->connect(); });
+        for (auto& thread : threads) thread.join();
+        threads.clear();
+
+        clock::time_point start = clock::now();
+        clock::time_point end = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(options_.seconds));
+        unsigned first = 0;
+        for (auto& worker : workers_) {
+            threads.emplace_back([&worker, start, end, first] { worker->run(start, end, first); });
+            first += worker->size();
+        }
+        for (auto& thread : threads) thread.join();
+
+        Report report;
+        report.elapsed = options_.seconds;
+        for (auto& worker : workers_) {
+            report.elapsed = std::max(report.elapsed, std::chrono::duration<double>(worker->last_response - start).count());
+            report.latency.merge(worker->latency);
+            report.completed += worker->completed;
+            report.timed_out += worker->timed_out;
+            report.failed_connections += worker->failed;
+        }
+        return report;
+    }
+
+private:
+    static constexpr std::size_t max_batch = 64; // Requests per write
+
+    struct Connection {
+        explicit Connection(boost::asio::io_context& io_context) : socket(io_context), timer(io_context) {}
+
+        tcp::socket socket;
+        boost::asio::steady_timer timer; // Open loop: next due request
+        std::deque<clock::time_point> outstanding; // Due (open loop) or send (closed loop) time of each unanswered request
+        std::vector<char> buffer = std::vector<char>(4096);
+        std::size_t filled = 0;
+        bool sending_done = false;
+        bool connected = false;
+    };
+
+    class Worker {
+    public:
+        Worker(const LoadOptions& options, const tcp::resolver::results_type& endpoints, unsigned connections)
+            : options_(options), endpoints_(endpoints), drain_timer_(io_context_) {
+            for (unsigned i = 0; i < connections; ++i) connections_.push_back(std::make_unique<Connection>(io_context_));
+            // max_batch requests back to back; a write of n requests sends a prefix
+            std::string payload(options.size, 'x');
+            unsigned char header[frame::header_size];
+            frame::write_header(header, static_cast<std::uint32_t>(payload.size()));
+            for (std::size_t i = 0; i < max_batch; ++i) {
+                requests_.insert(requests_.end(), header, header + frame::header_size);
+                requests_.insert(requests_.end(), payload.begin(), payload.end());
+            }
+        }
+
+        std::size_t size() const { return connections_.size(); }
+
+        void connect() {
+            for (auto& connection : connections_) {
+                boost::system::error_code ec;
+                boost::asio::connect(connection->socket, endpoints_, ec);
+                if (!ec) options_.socket.apply(connection->socket.native_handle());
+                connection->connected = !ec;
+                if (ec) ++failed;
+            }
+        }
+
+        // `first` is the index of this worker's first connection among all of them
+        void run(clock::time_point start, clock::time_point end, unsigned first) {
+            active_ = 0;
+            for (std::size_t i = 0; i < connections_.size(); ++i) {
+                Connection& connection = *connections_[i];
+                if (!connection.connected) continue;
+                ++active_;
+                if (options_.rate > 0) {
+                    // Connection k sends at start + (k + n * connections) / rate: evenly interleaved
+                    auto interval = std::chrono::duration<double>(options_.connections / options_.rate);
+                    auto offset = std::chrono::duration<double>((first + i) / options_.rate);
+                    coro::spawn(open_loop_writer(connection, start + std::chrono::duration_cast<clock::duration>(offset),
+                                                 std::chrono::duration_cast<clock::duration>(interval), end));
+                    coro::spawn(open_loop_reader(connection));
+                } else {
+                    coro::spawn(closed_loop(connection, end));
+                }
+            }
+            // After the drain period, give up on whatever is still outstanding
+            drain_timer_.expires_at(end + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(options_.drain)));
+            drain_timer_.async_wait([this](boost::system::error_code ec) {
+                if (ec) return;
+                for (auto& connection : connections_) {
+                    boost::system::error_code ignored;
+                    connection->timer.cancel();
+                    connection->socket.cancel(ignored);
+                }
+            });
+            if (active_ == 0) drain_timer_.cancel();
+            io_context_.run();
+        }
+
+        HdrHistogram latency;
+        clock::time_point last_response;
+        std::size_t completed = 0;
+        std::size_t timed_out = 0;
+        std::size_t failed = 0;
+
+    private:
+        // Send n requests, up to max_batch per write
+        coro::task<bool> send(Connection& connection, std::size_t n) {
+            std::size_t request_size = requests_.size() / max_batch;
+            while (n > 0) {
+                std::size_t batch = std::min(n, max_batch);
+                auto [ec, written] = co_await boost::asio::async_write(
+                    connection.socket, boost::asio::buffer(requests_.data(), batch * request_size), coro::use_task);
+                if (ec) co_return false;
+                n -= batch;
+            }
+            co_return true;
+        }
+
+        // Read once and record every response that completed; false on error or end of stream
+        coro::task<bool> receive(Connection& connection, std::size_t& responses) {
+            auto [ec, length] = co_await connection.socket.async_read_some(
+                boost::asio::buffer(connection.buffer.data() + connection.filled, connection.buffer.size() - connection.filled),
+                coro::use_task);
+            if (ec) co_return false;
+            options_.socket.after_read(connection.socket.native_handle());
+            connection.filled += length;
+            clock::time_point now = clock::now();
+            std::size_t consumed = frame::parse(connection.buffer.data(), connection.filled, std::numeric_limits<std::uint32_t>::max(),
+                [&](const char*, std::size_t) {
+                    if (connection.outstanding.empty()) return; // Not ours; the server misbehaved
+                    latency.record(static_cast<std::uint64_t>((now - connection.outstanding.front()).count()));
+                    connection.outstanding.pop_front();
+                    last_response = now;
+                    ++completed;
+                    ++responses;
+                });
+            std::memmove(connection.buffer.data(), connection.buffer.data() + consumed, connection.filled - consumed);
+            connection.filled -= consumed;
+            std::size_t needed = frame::frame_size(connection.buffer.data(), connection.filled);
+            if (needed > connection.buffer.size()) connection.buffer.resize(needed);
+            co_return true;
+        }
+
+        coro::task<void> closed_loop(Connection& connection, clock::time_point end) {
+            for (std::size_t i = 0; i < options_.depth; ++i) connection.outstanding.push_back(clock::now());
+            bool ok = co_await send(connection, options_.depth);
+            while (ok && !connection.outstanding.empty()) {
+                std::size_t responses = 0;
+                ok = co_await receive(connection, responses);
+                if (!ok || responses == 0 || clock::now() >= end) continue;
+                clock::time_point now = clock::now();
+                for (std::size_t i = 0; i < responses; ++i) connection.outstanding.push_back(now);
+                ok = co_await send(connection, responses);
+            }
+            finish(connection);
+        }
+
+        coro::task<void> open_loop_writer(Connection& connection, clock::time_point next, clock::duration interval,
+                                          clock::time_point end) {
+            while (next < end) {
+                connection.timer.expires_at(next);
+                boost::system::error_code ec = co_await connection.timer.async_wait(coro::use_task);
+                if (ec) break;
+                clock::time_point now = clock::now();
+                std::size_t n = 0;
+                for (; next <= now && next < end && n < max_batch; next += interval, ++n) {
+                    connection.outstanding.push_back(next); // Latency counts from when it was due
+                }
+                bool sent = co_await send(connection, n);
+                if (!sent) break;
+            }
+            connection.sending_done = true;
+            if (connection.outstanding.empty()) {
+                boost::system::error_code ignored;
+                connection.socket.cancel(ignored); // The reader is waiting for responses that will never come
+            }
+        }
+
+        coro::task<void> open_loop_reader(Connection& connection) {
+            for (;;) {
+                if (connection.sending_done && connection.outstanding.empty()) break;
+                std::size_t responses = 0;
+                bool ok = co_await receive(connection, responses);
+                if (!ok) break;
+            }
+            connection.timer.cancel(); // Stops the writer if the connection failed
+            finish(connection);
+        }
+
+        // Account for what is still outstanding and close. Unanswered requests
+        // are recorded as lasting until now, so giving up does not hide them.
+        void finish(Connection& connection) {
+            clock::time_point now = clock::now();
+            bool drained = now >= drain_timer_.expiry();
+            for (clock::time_point due : connection.outstanding) {
+                if (drained) latency.record(static_cast<std::uint64_t>((now - due).count()));
+            }
+            if (drained) {
+                timed_out += connection.outstanding.size();
+            } else if (!connection.outstanding.empty()) {
+                ++failed; // Reset or closed mid-run
+            }
+            connection.outstanding.clear();
+            boost::system::error_code ignored;
+            connection.socket.shutdown(tcp::socket::shutdown_both, ignored);
+            connection.socket.close(ignored);
+            if (--active_ == 0) drain_timer_.cancel();
+        }
+
+        const LoadOptions& options_;
+        const tcp::resolver::results_type& endpoints_;
+        boost::asio::io_context io_context_{1};
+        boost::asio::steady_timer drain_timer_;
+        std::vector<std::unique_ptr<Connection>> connections_;
+        std::vector<char> requests_;
+        std::size_t active_ = 0; // Connections still running
+    };
+
+    const LoadOptions& options_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+};
+
+// key=value arguments (and the bare word "json") into LoadOptions
+inline LoadOptions parse_load_options(int argc, char* argv[], int first) {
+    LoadOptions options;
+    for (int i = first; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "json") {
+            options.json = true;
+            continue;
+        }
+        auto eq = arg.find('=');
+        if (eq == std::string::npos) throw std::invalid_argument("expected key=value: " + arg);
+        std::string key = arg.substr(0, eq);
+        double value = std::stod(arg.substr(eq + 1));
+        if (key == "connections") options.connections = static_cast<unsigned>(value);
+        else if (key == "threads") options.threads = static_cast<unsigned>(value);
+        else if (key == "seconds") options.seconds = value;
+        else if (key == "rate") options.rate = value;
+        else if (key == "depth") options.depth = static_cast<std::size_t>(value);
+        else if (key == "size") options.size = static_cast<std::size_t>(value);
+        else if (key == "drain") options.drain = value;
+        else if (key == "expected") options.expected = value;
+        else if (!parse_socket_option(key, static_cast<long>(value), options.socket)) {
+            throw std::invalid_argument("unknown option: " + key);
+        }
+    }
+    options.threads = std::max(1u, std::min(options.threads, std::max(1u, options.connections)));
+    options.depth = std::max<std::size_t>(1, options.depth);
+    return options;
+}
+
+inline void print_load_report(const LoadOptions& options, const LoadGenerator::Report& report) {
+    double throughput = report.completed / report.elapsed;
+    const double us = 1000.0; // Histogram values are nanoseconds
+    bool closed = options.rate <= 0;
+    bool corrected = closed && options.expected > 0;
+    auto expected_interval = static_cast<std::uint64_t>(options.expected * us);
+
+    if (options.json) {
+        std::cout << "{\"mode\": \"" << (closed ? "closed" : "open") << "\", \"connections\": " << options.connections
+                  << ", \"threads\": " << options.threads << ", \"seconds\": " << options.seconds
+                  << ", \"rate\": " << options.rate << ", \"depth\": " << options.depth
+                  << ", \"completed\": " << report.completed << ", \"timed_out\": " << report.timed_out
+                  << ", \"failed_connections\": " << report.failed_connections
+                  << ", \"throughput\": " << throughput << ", \"latency_us\": ";
+        report.latency.write_json(std::cout, us);
+        if (corrected) {
+            std::cout << ", \"corrected_latency_us\": ";
+            report.latency.corrected(expected_interval).write_json(std::cout, us);
+        }
+        std::cout << "}" << std::endl;
+        return;
+    }
+
+    if (closed) {
+        std::cout << "Closed loop, " << options.connections << " connections on " << options.threads
+                  << " threads, depth " << options.depth << ", " << options.seconds << " s\n";
+    } else {
+        std::cout << "Open loop, " << options.connections << " connections on " << options.threads
+                  << " threads, " << options.rate << " req/s offered, " << options.seconds << " s\n";
+    }
+    std::cout << "  completed " << report.completed << ", timed out " << report.timed_out
+              << ", failed connections " << report.failed_connections << "\n"
+              << "  throughput " << static_cast<long>(throughput) << " req/s\n"
+              << (closed ? "  latency (us):           " : "  latency from due time (us): ");
+    report.latency.print_summary(std::cout, us);
+    if (corrected) {
+        std::cout << "\n  corrected for coordinated omission (us): ";
+        report.latency.corrected(expected_interval).print_summary(std::cout, us);
+    }
+    std::cout << std::endl;
+}
@@ -0,0 +1,378 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+
+// Bounded multi-producer/multi-consumer queue (Dmitry Vyukov's ring buffer).
+//
+// Every cell carries a sequence number that says whose turn it is: a producer
+// holding ticket `pos` may fill the cell when sequence == pos, a consumer holding
+// ticket `pos` may empty it when sequence == pos + 1. Claiming a ticket is one
+// CAS on the head (producers) or tail (consumers), which live on separate cache
+// lines, so producers and consumers only meet on the cells themselves.
+//
+// try_* never block. push/pop spin briefly and then sleep until the other side
+// makes progress; the *_for variants give up after a timeout. Sleeping is only
+// paid for by threads that actually have to wait: a successful push or pop
+// notifies only when some thread is parked on the opposite side.
+//
+// close() ends the stream: pushes fail from then on, and pops drain what is
+// left before failing.
+template<class T>
+class BoundedMPMCQueue {
+public:
+    // Capacity is rounded up to a power of two
+    explicit BoundedMPMCQueue(std::size_t capacity)
+        : mask_(round_up_pow2(capacity < 2 ? 2 : capacity) - 1),
+          cells_(new Cell[mask_ + 1]) {
+        for (std::size_t i = 0; i <= mask_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~BoundedMPMCQueue() {
+        T value;
+        while (try_pop(value)) {}
+    }
+
+    BoundedMPMCQueue(const BoundedMPMCQueue&) = delete;
+    BoundedMPMCQueue& operator=(const BoundedMPMCQueue&) = delete;
+
+    std::size_t capacity() const { return mask_ + 1; }
+
+    // Number of queued elements; only a snapshot while other threads are active
+    std::size_t size_approx() const {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        std::size_t head = head_.load(std::memory_order_relaxed);
+        return head > tail ? head - tail : 0;
+    }
+
+    // Non-blocking push; fails if the queue is full or closed
+    template<class U>
+    bool try_push(U&& value) {
+        if (closed_.load(std::memory_order_relaxed)) return false;
+        if (!enqueue(std::forward<U>(value))) return false;
+        not_empty_.notify();
+        return true;
+    }
+
+    // Non-blocking pop; fails if the queue is empty
+    bool try_pop(T& out) {
+        if (!dequeue(out)) return false;
+        not_full_.notify();
+        return true;
+    }
+
+    // Blocks while the queue is full; fails only once the queue is closed
+    template<class U>
+    bool push(U&& value) {
+        return wait_for_push(std::forward<U>(value), nullptr);
+    }
+
+    // Blocks while the queue is empty; fails once it is closed and drained
+    bool pop(T& out) {
+        return wait_for_pop(out, nullptr);
+    }
+
+    template<class U, class Rep, class Period>
+    bool try_push_for(U&& value, std::chrono::duration<Rep, Period> timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        return wait_for_push(std::forward<U>(value), &deadline);
+    }
+
+    template<class Rep, class Period>
+    bool try_pop_for(T& out, std::chrono::duration<Rep, Period> timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        return wait_for_pop(out, &deadline);
+    }
+
+    // Push up to `count` elements from `first` with a single head CAS and at
+    // most one wake-up. Returns how many were pushed (a prefix of the input).
+    template<class It>
+    std::size_t try_push_bulk(It first, std::size_t count) {
+        if (closed_.load(std::memory_order_relaxed)) return 0;
+        std::size_t pushed = enqueue_bulk(first, count);
+        if (pushed) not_empty_.notify();
+        return pushed;
+    }
+
+    // Pop up to `max` elements into `out` with a single tail CAS and at most
+    // one wake-up. Returns how many were popped.
+    template<class OutIt>
+    std::size_t try_pop_bulk(OutIt out, std::size_t max) {
+        std::size_t popped = dequeue_bulk(out, max);
+        if (popped) not_full_.notify();
+        return popped;
+    }
+
+    // Push all of [first, first + count), blocking while the queue is full.
+    // Returns fewer than `count` only if the queue was closed.
+    template<class It>
+    std::size_t push_bulk(It first, std::size_t count) {
+        std::size_t pushed = 0;
+        while (pushed < count) {
+            std::size_t n = 0;
+            bool ok = wait_until(not_full_, [&] {
+                if (closed_.load(std::memory_order_relaxed)) return true;
+                n = enqueue_bulk(first, count - pushed);
+                return n > 0;
+            }, nullptr);
+            if (!ok || n == 0) break;  // Closed
+            not_empty_.notify();
+            pushed += n;
+        }
+        return pushed;
+    }
+
+    // Pop between 1 and `max` elements, blocking while the queue is empty.
+    // Returns 0 once the queue is closed and drained.
+    template<class OutIt>
+    std::size_t pop_bulk(OutIt out, std::size_t max) {
+        std::size_t n = 0;
+        wait_until(not_empty_, [&] {
+            n = dequeue_bulk(out, max);
+            return n > 0 || closed_.load(std::memory_order_acquire);
+        }, nullptr);
+        if (n == 0) n = dequeue_bulk(out, max);  // Anything pushed just before close()
+        if (n) not_full_.notify();
+        return n;
+    }
+
+    // Refuse further pushes and wake every waiting thread
+    void close() {
+        closed_.store(true, std::memory_order_release);
+        not_empty_.notify(true);
+        not_full_.notify(true);
+    }
+
+    bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* value() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    // Threads parked on one side of the queue (waiting for space or for data).
+    // notify() wakes all of them and deregisters them in one go, so the
+    // operations that follow skip the mutex until somebody parks again.
+    struct Parker {
+        std::atomic<int> waiters{0};
+        std::uint64_t generation = 0;  // Bumped by every wake-up; guarded by mutex
+        std::mutex mutex;
+        std::condition_variable cv;
+
+        void notify(bool force = false) {
+            // Pairs with the fence in wait_until: either we see the waiter, or it sees our cell
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!force && waiters.load(std::memory_order_relaxed) == 0) return;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                waiters.store(0, std::memory_order_relaxed);
+                ++generation;
+            }
+            cv.notify_all();
+        }
+    };
+
+    static constexpr std::size_t cache_line = 64;
+    static constexpr int max_spins = 64;
+
+    // Busy-waiting only helps if the thread we wait for runs on another core;
+    // on a single core, yield to it instead
+    static void backoff() {
+        static const bool single_core = std::thread::hardware_concurrency() <= 1;
+        if (single_core) {
+            std::this_thread::yield();
+        } else {
+            cpu_relax();
+        }
+    }
+
+    static std::size_t round_up_pow2(std::size_t n) {
+        std::size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    template<class U>
+    bool enqueue(U&& value) {
+        std::size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            if (seq == pos) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    new (cell.storage) T(std::forward<U>(value));
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (seq < pos) {
+                return false;  // Cell still holds the element from the previous lap: full
+            } else {
+                pos = head_.load(std::memory_order_relaxed);  // Another producer got there first
+            }
+        }
+    }
+
+    bool dequeue(T& out) {
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+            if (seq == pos + 1) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    out = std::move(*cell.value());
+                    cell.value()->~T();
+                    cell.sequence.store(pos + mask_ + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (seq < pos + 1) {
+                return false;  // Not yet filled: empty
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Claim the longest run of free cells at the head (up to count) with one CAS.
+    // A free cell can only become occupied by a producer that owns its ticket,
+    // so cells seen free before a successful CAS are still free after it.
+    template<class It>
+    std::size_t enqueue_bulk(It& first, std::size_t count) {
+        std::size_t pos = head_.load(std::memory_order_relaxed);
+        for (;;) {
+            std::size_t n = 0;
+            while (n < count && n <= mask_ &&
+                   cells_[(pos + n) & mask_].sequence.load(std::memory_order_acquire) == pos + n) {
+                ++n;
+            }
+            if (n == 0) {
+                std::size_t seq = cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+                if (seq < pos) return 0;  // Full
+                pos = head_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (head_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                for (std::size_t i = 0; i < n; ++i, ++first) {
+                    Cell& cell = cells_[(pos + i) & mask_];
+                    new (cell.storage) T(*first);
+                    cell.sequence.store(pos + i + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    template<class OutIt>
+    std::size_t dequeue_bulk(OutIt& out, std::size_t max) {
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            std::size_t n = 0;
+            while (n < max && n <= mask_ &&
+                   cells_[(pos + n) & mask_].sequence.load(std::memory_order_acquire) == pos + n + 1) {
+                ++n;
+            }
+            if (n == 0) {
+                std::size_t seq = cells_[pos & mask_].sequence.load(std::memory_order_acquire);
+                if (seq < pos + 1) return 0;  // Empty
+                pos = tail_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (tail_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed)) {
+                for (std::size_t i = 0; i < n; ++i, ++out) {
+                    Cell& cell = cells_[(pos + i) & mask_];
+                    *out = std::move(*cell.value());
+                    cell.value()->~T();
+                    cell.sequence.store(pos + i + mask_ + 1, std::memory_order_release);
+                }
+                return n;
+            }
+        }
+    }
+
+    // Spin on `attempt`, then park on `parker` until it succeeds or the
+    // deadline passes. `attempt` is re-run under the parker's mutex after
+    // registering as a waiter, so a notify between the check and the sleep
+    // cannot be lost.
+    template<class Attempt>
+    bool wait_until(Parker& parker, Attempt&& attempt,
+                    const std::chrono::steady_clock::time_point* deadline) {
+        for (int spin = 0; spin < max_spins; ++spin) {
+            if (attempt()) return true;
+            backoff();
+        }
+
+        std::unique_lock<std::mutex> lock(parker.mutex);
+        for (;;) {
+            parker.waiters.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (attempt()) {
+                parker.waiters.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+
+            std::uint64_t generation = parker.generation;
+            bool timed_out = false;
+            if (!deadline) {
+                parker.cv.wait(lock);
+            } else {
+                timed_out = parker.cv.wait_until(lock, *deadline) == std::cv_status::timeout;
+            }
+            if (parker.generation == generation) {
+                parker.waiters.fetch_sub(1, std::memory_order_relaxed);  // Not deregistered by a notify
+            }
+            if (timed_out) return attempt();
+        }
+    }
+
+    template<class U>
+    bool wait_for_push(U&& value, const std::chrono::steady_clock::time_point* deadline) {
+        bool pushed = false;
+        wait_until(not_full_, [&] {
+            if (closed_.load(std::memory_order_relaxed)) return true;
+            return pushed = enqueue(std::forward<U>(value));
+        }, deadline);
+        if (pushed) not_empty_.notify();
+        return pushed;
+    }
+
+    bool wait_for_pop(T& out, const std::chrono::steady_clock::time_point* deadline) {
+        bool popped = false;
+        wait_until(not_empty_, [&] {
+            if (dequeue(out)) return popped = true;
+            if (!closed_.load(std::memory_order_acquire)) return false;
+            popped = dequeue(out);  // Anything pushed just before close()
+            return true;
+        }, deadline);
+        if (popped) not_full_.notify();
+        return popped;
+    }
+
+    const std::size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+
+    alignas(cache_line) std::atomic<std::size_t> head_{0};  // Next ticket for producers
+    alignas(cache_line) std::atomic<std::size_t> tail_{0};  // Next ticket for consumers
+    alignas(cache_line) std::atomic<bool> closed_{false};
+    Parker not_empty_;  // Consumers waiting for data
+    Parker not_full_;  // Producers waiting for space
+};
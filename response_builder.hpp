@@ -0,0 +1,148 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "coro_asio.hpp"
+#include "frame_protocol.hpp"
+
+// A response assembled as a list of buffers instead of one concatenated
+// string. Each part points at memory that outlives the write (string literals,
+// cached blobs, mapped files), so the whole response goes out with one
+// gathered write (writev) and no byte is copied in user space. Small pieces
+// the caller cannot keep alive, such as frame headers, are copied into a
+// scratch area inside the builder.
+//
+// The buffers point into the builder itself, so it must stay put (and
+// unchanged) until the write that uses buffers() has completed.
+template<std::size_t MaxBuffers, std::size_t ScratchBytes = 256>
+class ResponseBuilder {
+public:
+    ResponseBuilder() = default;
+    ResponseBuilder(const ResponseBuilder&) = delete;
+    ResponseBuilder& operator=(const ResponseBuilder&) = delete;
+
+    // Reference `size` bytes owned by the caller. Fails if the builder is full.
+    bool add(const void* data, std::size_t size) {
+        if (count_ == MaxBuffers) return false;
+        buffers_[count_++] = boost::asio::const_buffer(data, size);
+        bytes_ += size;
+        return true;
+    }
+
+    bool add(boost::asio::const_buffer buffer) { return add(buffer.data(), buffer.size()); }
+
+    // Copy a small piece into the scratch area and reference the copy
+    bool add_copy(const void* data, std::size_t size) {
+        if (ScratchBytes - scratch_used_ < size) return false;
+        char* copy = scratch_.data() + scratch_used_;
+        std::memcpy(copy, data, size);
+        if (!add(copy, size)) return false;
+        scratch_used_ += size;
+        return true;
+    }
+
+    // Append a length prefix (see frame_protocol.hpp) for a payload of `length` bytes
+    bool add_frame_header(std::uint32_t length) {
+        unsigned char header[frame::header_size];
+        frame::write_header(header, length);
+        return add_copy(header, frame::header_size);
+    }
+
+    std::span<const boost::asio::const_buffer> buffers() const { return {buffers_.data(), count_}; }
+    std::size_t buffer_count() const { return count_; }
+    std::size_t available() const { return MaxBuffers - count_; }
+    std::size_t size() const { return bytes_; }  // Total bytes in the response
+
+    void clear() {
+        count_ = 0;
+        bytes_ = 0;
+        scratch_used_ = 0;
+    }
+
+private:
+    std::array<boost::asio::const_buffer, MaxBuffers> buffers_;
+    std::size_t count_ = 0;
+    std::size_t bytes_ = 0;
+    std::array<char, ScratchBytes> scratch_;
+    std::size_t scratch_used_ = 0;
+};
+
+// A read-only file mapped into memory, so its contents can be referenced by
+// a ResponseBuilder (or sent with async_sendfile through fd()). Throws
+// std::system_error if the file cannot be opened or mapped.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path) {
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd_ < 0) throw std::system_error(errno, std::generic_category(), "open " + path);
+        struct stat st;
+        if (::fstat(fd_, &st) != 0) fail("fstat " + path);
+        size_ = static_cast<std::size_t>(st.st_size);
+        if (size_ > 0) { // mmap rejects empty mappings
+            void* data = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+            if (data == MAP_FAILED) fail("mmap " + path);
+            data_ = static_cast<const char*>(data);
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data_) ::munmap(const_cast<char*>(data_), size_);
+        ::close(fd_);
+    }
+
+    int fd() const { return fd_; }
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    boost::asio::const_buffer buffer() const { return {data_, size_}; }
+
+private:
+    [[noreturn]] void fail(const std::string& what) {
+        int error = errno;
+        ::close(fd_);
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    int fd_ = -1;
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+// Send `count` bytes of file `fd`, starting at `offset`, with sendfile(2): the
+// kernel moves the pages from the page cache to the socket without a copy
+// through user space. Whenever the socket buffer is full the coroutine waits
+// for the socket to become writable. Returns false on error.
+inline coro::task<bool> async_sendfile(boost::asio::ip::tcp::socket& socket, int fd, off_t offset, std::size_t count) {
+    boost::system::error_code ec;
+    socket.native_non_blocking(true, ec); // sendfile must return EAGAIN instead of blocking the thread
+    if (ec) co_return false;
+    while (count > 0) {
+        ssize_t sent = ::sendfile(socket.native_handle(), fd, &offset, count);
+        if (sent > 0) {
+            count -= static_cast<std::size_t>(sent);
+            continue;
+        }
+        if (sent == 0) co_return false; // The file is shorter than promised
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) co_return false;
+        boost::system::error_code wait_ec =
+            co_await socket.async_wait(boost::asio::ip::tcp::socket::wait_write, coro::use_task);
+        if (wait_ec) co_return false;
+    }
+    co_return true;
+}
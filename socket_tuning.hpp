@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+// Socket options for the demo9 client and server, settable on the command
+// line as key=value (see parse_socket_option). The defaults are what the
+// demos did before: TCP_NODELAY on, everything else left to the kernel.
+//
+// Buffer sizes matter most before the handshake, when the window scale is
+// negotiated: the server sets them on the listening socket, whose accepted
+// sockets inherit them. The client can only set them once connected, which
+// still caps the buffers but not the advertised scale.
+struct SocketTuning {
+    bool no_delay = true; // TCP_NODELAY: small writes go out at once instead of waiting for the previous ACK (Nagle)
+    int send_buffer = 0; // SO_SNDBUF bytes (the kernel doubles it), 0 = autotuned
+    int receive_buffer = 0; // SO_RCVBUF bytes, 0 = autotuned
+    bool quick_ack = false; // TCP_QUICKACK after every read: ACK at once instead of delaying it for a reply to ride on
+    int busy_poll_us = 0; // SO_BUSY_POLL: blocking reads spin this long on the device queue (needs CAP_NET_ADMIN)
+    int defer_accept_s = 0; // TCP_DEFER_ACCEPT (listeners): a connection is accepted only once its first data arrives
+
+    // Apply to a connected socket; false if the kernel rejected any option
+    bool apply(int fd) const {
+        bool ok = set(fd, IPPROTO_TCP, TCP_NODELAY, no_delay ? 1 : 0);
+        ok &= apply_buffers(fd);
+        if (quick_ack) ok &= set(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+        if (busy_poll_us) ok &= set(fd, SOL_SOCKET, SO_BUSY_POLL, busy_poll_us);
+        return ok;
+    }
+
+    // Apply to a listening socket, before listen(): buffer sizes and
+    // TCP_DEFER_ACCEPT are inherited by the sockets it accepts
+    bool apply_listener(int fd) const {
+        bool ok = apply_buffers(fd);
+        if (defer_accept_s) ok &= set(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept_s);
+        return ok;
+    }
+
+    // The kernel leaves quick-ACK mode again on its own, so it has to be
+    // re-enabled after every read
+    void after_read(int fd) const {
+        if (quick_ack) set(fd, IPPROTO_TCP, TCP_QUICKACK, 1);
+    }
+
+    // Options that apply to datagram sockets (buffers and busy polling)
+    bool apply_datagram(int fd) const {
+        bool ok = apply_buffers(fd);
+        if (busy_poll_us) ok &= set(fd, SOL_SOCKET, SO_BUSY_POLL, busy_poll_us);
+        return ok;
+    }
+
+private:
+    static bool set(int fd, int level, int name, int value) {
+        return ::setsockopt(fd, level, name, &value, sizeof(value)) == 0;
+    }
+
+    bool apply_buffers(int fd) const {
+        bool ok = true;
+        if (send_buffer) ok &= set(fd, SOL_SOCKET, SO_SNDBUF, send_buffer);
+        if (receive_buffer) ok &= set(fd, SOL_SOCKET, SO_RCVBUF, receive_buffer);
+        return ok;
+    }
+};
+
+// Sets the SocketTuning field named by `key` (no_delay=0|1, send_buffer=bytes,
+// receive_buffer=bytes, quick_ack=0|1, busy_poll=us, defer_accept=s); false if
+// `key` is not one of them
+inline bool parse_socket_option(const std::string& key, long value, SocketTuning& tuning) {
+    if (key == "no_delay") tuning.no_delay = value != 0;
+    else if (key == "send_buffer") tuning.send_buffer = static_cast<int>(value);
+    else if (key == "receive_buffer") tuning.receive_buffer = static_cast<int>(value);
+    else if (key == "quick_ack") tuning.quick_ack = value != 0;
+    else if (key == "busy_poll") tuning.busy_poll_us = static_cast<int>(value);
+    else if (key == "defer_accept") tuning.defer_accept_s = static_cast<int>(value);
+    else return false;
+    return true;
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+
+// Wait-free single-producer/single-consumer ring with a compile-time capacity.
+//
+// The producer owns head_ and the consumer owns tail_; each side keeps a cached
+// copy of the other side's index on its own cache line and only re-reads the
+// shared one when the cache says the ring is full (producer) or empty
+// (consumer). In steady state a push or pop touches no cache line written by
+// the other thread except the slot itself.
+//
+// Besides try_push/try_pop there is a zero-copy interface:
+//   producer: void* slot = reserve(); new (slot) T(...); commit();
+//   consumer: T* item = peek(); use(*item); release();
+// which lets large messages be built and read in place.
+template<class T, std::size_t Capacity>
+class SPSCQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "SPSCQueue capacity must be a power of two");
+
+public:
+    SPSCQueue() = default;
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+    ~SPSCQueue() {
+        while (peek()) release();
+    }
+
+    static constexpr std::size_t capacity() { return Capacity; }
+
+    // Producer: storage for the next element, or nullptr if the ring is full.
+    // Construct a T there, then call commit().
+    void* reserve() {
+        std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_cache_ == Capacity) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head - tail_cache_ == Capacity) return nullptr;
+        }
+        return slots_[head & mask].storage;
+    }
+
+    // Producer: publish the element constructed in the reserved slot
+    void commit() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    // Consumer: the oldest element, or nullptr if the ring is empty
+    T* peek() {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_cache_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail == head_cache_) return nullptr;
+        }
+        return slots_[tail & mask].value();
+    }
+
+    // Consumer: destroy the element returned by peek() and free its slot
+    void release() {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        slots_[tail & mask].value()->~T();
+        tail_.store(tail + 1, std::memory_order_release);
+    }
+
+    template<class... Args>
+    bool try_emplace(Args&&... args) {
+        void* slot = reserve();
+        if (!slot) return false;
+        new (slot) T(std::forward<Args>(args)...);
+        commit();
+        return true;
+    }
+
+    template<class U>
+    bool try_push(U&& value) {
+        return try_emplace(std::forward<U>(value));
+    }
+
+    bool try_pop(T& out) {
+        T* item = peek();
+        if (!item) return false;
+        out = std::move(*item);
+        release();
+        return true;
+    }
+
+    // Either side may call these; the answer can be stale by the time it returns
+    bool empty() const {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+    bool full() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire) == Capacity;
+    }
+
+private:
+    static constexpr std::size_t mask = Capacity - 1;
+    static constexpr std::size_t cache_line = 64;
+
+    struct Slot {
+        alignas(T) unsigned char storage[sizeof(T)];
+
+        T* value() { return std::launder(reinterpret_cast<T*>(storage)); }
+    };
+
+    alignas(cache_line) std::atomic<std::size_t> head_{0};  // Written by the producer
+    std::size_t tail_cache_ = 0;  // Producer's last view of tail_
+
+    alignas(cache_line) std::atomic<std::size_t> tail_{0};  // Written by the consumer
+    std::size_t head_cache_ = 0;  // Consumer's last view of head_
+
+    alignas(cache_line) Slot slots_[Capacity];
+};
+
+// SPSCQueue with blocking push/pop for pipelines where either side may outrun
+// the other. A thread spins briefly and then sleeps only when the ring is full
+// (producer) or empty (consumer); the other side takes the mutex to wake it
+// only while it is actually asleep, so the fast path stays wait-free.
+//
+// close() is called by the producer when it is done: the consumer drains what
+// is left and then pop()/peek() fail.
+template<class T, std::size_t Capacity>
+class BlockingSPSCQueue {
+public:
+    // Producer: blocks until a slot is free; nullptr once the queue is closed
+    void* reserve() {
+        void* slot = nullptr;
+        wait(producer_sleeping_, [&] {
+            slot = queue_.reserve();
+            return slot != nullptr || closed_.load(std::memory_order_acquire);
+        });
+        return closed_.load(std::memory_order_relaxed) ? nullptr : slot;
+    }
+
+    void commit() {
+        queue_.commit();
+        wake(consumer_sleeping_);
+    }
+
+    // Consumer: blocks until an element is available; nullptr once the queue
+    // is closed and drained
+    T* peek() {
+        T* item = nullptr;
+        wait(consumer_sleeping_, [&] {
+            item = queue_.peek();
+            return item != nullptr || closed_.load(std::memory_order_acquire);
+        });
+        return item ? item : queue_.peek();  // Anything committed just before close()
+    }
+
+    void release() {
+        queue_.release();
+        wake(producer_sleeping_);
+    }
+
+    template<class U>
+    bool push(U&& value) {
+        void* slot = reserve();
+        if (!slot) return false;
+        new (slot) T(std::forward<U>(value));
+        commit();
+        return true;
+    }
+
+    bool pop(T& out) {
+        T* item = peek();
+        if (!item) return false;
+        out = std::move(*item);
+        release();
+        return true;
+    }
+
+    void close() {
+        closed_.store(true, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            consumer_sleeping_.store(false, std::memory_order_relaxed);
+            producer_sleeping_.store(false, std::memory_order_relaxed);
+        }
+        cv_.notify_all();
+    }
+
+private:
+    static constexpr int max_spins = 64;
+
+    static void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    // Busy-waiting only helps if the other side runs on another core
+    static void backoff() {
+        static const bool single_core = std::thread::hardware_concurrency() <= 1;
+        if (single_core) {
+            std::this_thread::yield();
+        } else {
+            cpu_relax();
+        }
+    }
+
+    template<class Ready>
+    void wait(std::atomic<bool>& sleeping, Ready&& ready) {
+        for (int spin = 0; spin < max_spins; ++spin) {
+            if (ready()) return;
+            backoff();
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            sleeping.store(true, std::memory_order_relaxed);
+            // Pairs with the fence in wake(): either it sees us asleep, or we see its index
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ready()) break;
+            cv_.wait(lock);
+        }
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    void wake(std::atomic<bool>& sleeping) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!sleeping.load(std::memory_order_relaxed)) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sleeping.store(false, std::memory_order_relaxed);  // Later wakes skip the mutex
+        }
+        cv_.notify_all();
+    }
+
+    SPSCQueue<T, Capacity> queue_;
+    std::atomic<bool> closed_{false};
+    std::atomic<bool> producer_sleeping_{false};  // Waiting for a free slot
+    std::atomic<bool> consumer_sleeping_{false};  // Waiting for an element
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include <boost/asio.hpp>
+
+// Hierarchical hashed timing wheel for per-connection timeouts, ticked from an
+// io_context by a single steady_timer. A timer is an intrusive list node that
+// lives inside its owner (a Session), so arming and cancelling are O(1) list
+// splices with no allocation: compared with one steady_timer per connection,
+// there is no operation object to allocate and no heap of deadlines to keep
+// ordered on every read and write.
+//
+// Four levels of 64 slots: level 0 holds timers due in the next 64 ticks, level
+// n those due within 64^(n+1) ticks. Whenever a lower level wraps, the next
+// slot of the level above is redistributed (cascaded) into the levels below.
+// Timers are due at whole ticks and never fire early; they may fire up to one
+// tick late. The wheel is not thread-safe: arm, cancel and the io_context that
+// ticks it must all run on one thread.
+class TimingWheel {
+    struct Link {
+        Link* prev = this;
+        Link* next = this;
+
+        bool linked() const { return next != this; }
+
+        void unlink() {
+            prev->next = next;
+            next->prev = prev;
+            prev = next = this;
+        }
+
+        void push_back(Link& node) {
+            node.prev = prev;
+            node.next = this;
+            prev->next = &node;
+            prev = &node;
+        }
+
+        // Move every node of this list onto `to` (which must be empty)
+        void splice_into(Link& to) {
+            if (!linked()) return;
+            to.next = next;
+            to.prev = prev;
+            next->prev = &to;
+            prev->next = &to;
+            prev = next = this;
+        }
+    };
+
+public:
+    using clock = std::chrono::steady_clock;
+
+    // A timeout owned by the caller. callback(context) runs on the wheel's
+    // thread when it expires; destroying an armed timer cancels it.
+    class Timer : private Link {
+    public:
+        using Callback = void (*)(void* context);
+
+        Timer(Callback callback, void* context) : callback_(callback), context_(context) {}
+        Timer(const Timer&) = delete;
+        Timer& operator=(const Timer&) = delete;
+        ~Timer() { cancel(); }
+
+        bool armed() const { return linked(); }
+
+        void cancel() {
+            if (!linked()) return;
+            unlink();
+            --wheel_->armed_;
+        }
+
+    private:
+        friend class TimingWheel;
+
+        TimingWheel* wheel_ = nullptr;
+        std::uint64_t expiry_ = 0; // Tick at which the timer fires
+        Callback callback_;
+        void* context_;
+    };
+
+    static constexpr unsigned slot_bits = 6;
+    static constexpr std::size_t slots = std::size_t(1) << slot_bits;
+    static constexpr unsigned levels = 4;
+    static constexpr std::uint64_t max_ticks = (std::uint64_t(1) << (slot_bits * levels)) - 1; // Longer timeouts are clamped
+
+    explicit TimingWheel(boost::asio::io_context& io_context, clock::duration tick = std::chrono::milliseconds(10))
+        : ticker_(io_context), tick_(tick), origin_(clock::now()) {}
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    // Timers still armed are left disarmed, so their owners may outlive the wheel
+    ~TimingWheel() {
+        for (auto& level : wheel_) {
+            for (Link& slot : level) {
+                while (slot.linked()) slot.next->unlink();
+            }
+        }
+    }
+
+    // (Re)arm `timer` to expire `timeout` from now
+    void arm(Timer& timer, clock::duration timeout) {
+        timer.cancel();
+        if (armed_ == 0 && !ticking_) now_ = std::max(now_, elapsed_ticks() + 1); // Idle wheel: catch up with the clock
+        auto ticks = static_cast<std::uint64_t>((std::max(timeout, clock::duration::zero()) + tick_ - clock::duration(1)) / tick_);
+        // Count from the clock, not from now_: while the io_context lags, now_
+        // trails it, and a timeout counted from there would fire early
+        std::uint64_t from = std::max(now_, elapsed_ticks() + 1);
+        timer.wheel_ = this;
+        timer.expiry_ = std::min(from + ticks, now_ + max_ticks);
+        insert(timer);
+        if (++armed_ == 1 && !ticking_) schedule_tick();
+    }
+
+    std::size_t armed() const { return armed_; }
+
+private:
+    std::uint64_t elapsed_ticks() const { return static_cast<std::uint64_t>((clock::now() - origin_) / tick_); }
+
+    void insert(Timer& timer) {
+        std::uint64_t delta = timer.expiry_ - now_;
+        unsigned level = 0;
+        while (level + 1 < levels && delta >= (std::uint64_t(1) << (slot_bits * (level + 1)))) ++level;
+        std::size_t slot = (timer.expiry_ >> (slot_bits * level)) & (slots - 1);
+        wheel_[level][slot].push_back(timer);
+    }
+
+    // Re-insert the timers of one slot relative to the current tick
+    void cascade(unsigned level, std::size_t slot) {
+        Link moving;
+        wheel_[level][slot].splice_into(moving);
+        while (moving.linked()) {
+            Timer& timer = static_cast<Timer&>(*moving.next);
+            timer.unlink();
+            insert(timer);
+        }
+    }
+
+    // Run tick now_: cascade the levels that wrap, then fire level 0's slot
+    void step() {
+        std::uint64_t tick = now_;
+        for (unsigned level = 1; level < levels; ++level) {
+            if ((tick >> (slot_bits * (level - 1))) & (slots - 1)) break; // The level below has not wrapped
+            cascade(level, (tick >> (slot_bits * level)) & (slots - 1));
+        }
+        Link expired;
+        wheel_[0][tick & (slots - 1)].splice_into(expired);
+        ++now_; // Timers armed by the callbacks land in later slots
+        while (expired.linked()) {
+            Timer& timer = static_cast<Timer&>(*expired.next);
+            timer.unlink();
+            --armed_;
+            timer.callback_(timer.context_);
+        }
+    }
+
+    // The steady_timer only runs while timers are armed
+    void schedule_tick() {
+        ticking_ = true;
+        ticker_.expires_at(origin_ + tick_ * now_);
+        ticker_.async_wait([this](boost::system::error_code ec) {
+            ticking_ = false;
+            if (ec) return;
+            std::uint64_t due = elapsed_ticks();
+            while (now_ <= due && armed_ > 0) step();
+            if (armed_ > 0) schedule_tick();
+        });
+    }
+
+    Link wheel_[levels][slots];
+    boost::asio::steady_timer ticker_;
+    clock::duration tick_;
+    clock::time_point origin_; // Tick 0
+    std::uint64_t now_ = 0; // Next tick to run
+    std::size_t armed_ = 0;
+    bool ticking_ = false;
+};
@@ -0,0 +1,488 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <liburing.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "aligned_buffer_pool.hpp"
+
+// Settings for UringCopier
+struct CopyOptions {
+    unsigned depth = 32; // Blocks in flight, each a linked read -> write pair
+    std::size_t block_size = 128 * 1024; // Bytes per block; in-flight buffer memory is depth * block_size
+    bool registered = true; // Registered buffers and files (falls back to plain ones if the kernel refuses)
+    unsigned max_open = 64; // copy_all: files open (or being opened) at once
+    unsigned large_files = 2; // copy_all: how many of those may be larger than small_file (at least 1)
+    std::uint64_t small_file = 256 * 1024; // copy_all: files up to this size go first
+    bool direct = false; // O_DIRECT where the filesystem allows it (block_size is then rounded up to 4 KiB)
+};
+
+// One file for UringCopier::copy_all
+struct CopyJob {
+    std::string source;
+    std::string destination;
+    std::uint64_t size = 0; // Bytes to copy, as listed
+};
+
+struct CopyStats {
+    std::size_t files = 0; // Files copied
+    std::size_t failed = 0;
+    std::uint64_t bytes = 0;
+    double seconds = 0;
+    std::size_t short_reads = 0; // Reads that returned less than asked and were resumed
+    std::size_t short_writes = 0; // Likewise for writes
+    std::size_t buffered_fallbacks = 0; // Files that went through the page cache although O_DIRECT was asked for
+    std::vector<std::string> errors; // One line per failed file
+
+    double gb_per_second() const { return seconds > 0 ? bytes / seconds / 1e9 : 0; }
+    double files_per_second() const { return seconds > 0 ? files / seconds : 0; }
+
+    // Combine the stats of copiers that ran side by side
+    CopyStats& operator+=(const CopyStats& other) {
+        files += other.files;
+        failed += other.failed;
+        bytes += other.bytes;
+        seconds = std::max(seconds, other.seconds);
+        short_reads += other.short_reads;
+        short_writes += other.short_writes;
+        buffered_fallbacks += other.buffered_fallbacks;
+        errors.insert(errors.end(), other.errors.begin(), other.errors.end());
+        return *this;
+    }
+};
+
+// Copies files with io_uring, keeping `depth` blocks in flight.
+//
+// Every block is one read linked (IOSQE_IO_LINK) to the write of the same
+// buffer, so the kernel starts the write as soon as the read completes,
+// without a round trip through this thread; the thread only sees a block
+// again when its write is done, and then reuses the buffer for the next one.
+// The buffers are registered once (io_uring_register_buffers), so the kernel
+// does not pin and unpin their pages on every operation. copy() also puts
+// its two files in a registered file table, so no operation takes a file
+// reference.
+//
+// copy_all() runs many files through the same ring and buffers. Opens (the
+// source linked to the destination, so a missing source creates nothing)
+// and closes are ring operations too, submitted in the same batches as the
+// data. Files up to small_file are opened and given buffers first; larger
+// ones, at most large_files at a time, take the buffers the small files
+// leave idle while they wait on metadata.
+//
+// A read that returns less than asked breaks the link: its write completes
+// with -ECANCELED (or, if it ran, wrote stale bytes). The block is then
+// resumed with a read of the rest linked to a write of the whole block.
+// A short write is resumed with a write of the rest.
+//
+// With `direct`, files are opened with O_DIRECT, so the copy neither fills
+// the page cache nor evicts what is in it. The buffers come from an
+// AlignedBufferPool, blocks start at multiples of 4 KiB, and the unaligned
+// tail of a file is read and written as a whole 4 KiB block: its read comes
+// back short at end of file (so it is not linked to the write), and the
+// destination is truncated to size afterwards. A file on a filesystem that
+// rejects O_DIRECT is copied through the page cache instead.
+//
+// Not thread-safe; use one copier per thread.
+class UringCopier {
+public:
+    explicit UringCopier(const CopyOptions& options = {})
+        : options_(options), slots_(options.depth), files_(std::max(options.max_open, 1u)) {
+        if (options_.depth == 0 || options_.block_size == 0 || options_.block_size > (1u << 30)) {
+            throw std::invalid_argument("UringCopier: depth and block size must be positive (block size up to 1 GiB)");
+        }
+        if (options_.direct) options_.block_size = align_up(options_.block_size);
+        options_.large_files = std::max(options_.large_files, 1u); // Otherwise large files would never be opened
+        buffers_.emplace(options_.block_size, options_.depth);
+        int ret = io_uring_queue_init(2 * (options_.depth + static_cast<unsigned>(files_.size())), &ring_, 0);
+        if (ret < 0) throw std::system_error(-ret, std::generic_category(), "io_uring_queue_init");
+
+        if (options_.registered) {
+            std::vector<iovec> iovecs(options_.depth);
+            for (unsigned i = 0; i < options_.depth; ++i) iovecs[i] = {buffer(i), buffers_->buffer_size()};
+            fixed_buffers_ = io_uring_register_buffers(&ring_, iovecs.data(), options_.depth) == 0;
+            int sparse[2] = {-1, -1}; // Filled per copy with io_uring_register_files_update
+            fixed_files_ = io_uring_register_files(&ring_, sparse, 2) == 0;
+        }
+    }
+
+    UringCopier(const UringCopier&) = delete;
+    UringCopier& operator=(const UringCopier&) = delete;
+
+    ~UringCopier() {
+        io_uring_queue_exit(&ring_); // Also drops the registrations
+    }
+
+    bool registered_buffers() const { return fixed_buffers_; }
+    bool registered_files() const { return fixed_files_; }
+    bool huge_pages() const { return buffers_->huge_pages(); }
+
+    // Copy `source` to `destination` (created or truncated). Throws
+    // std::system_error on failure.
+    CopyStats copy(const std::string& source, const std::string& destination) {
+        auto start = std::chrono::steady_clock::now();
+        bool in_direct = options_.direct;
+        bool out_direct = options_.direct;
+        int in = open_direct(source.c_str(), O_RDONLY | O_CLOEXEC, 0, in_direct);
+        if (in < 0) throw std::system_error(errno, std::generic_category(), "open " + source);
+        int out = open_direct(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644, out_direct);
+        if (out < 0) {
+            int error = errno;
+            ::close(in);
+            throw std::system_error(error, std::generic_category(), "open " + destination);
+        }
+        struct stat st;
+        ::fstat(in, &st);
+
+        CopyJob job{source, destination, static_cast<std::uint64_t>(st.st_size)};
+        reset(nullptr);
+        File& file = files_[take_file()];
+        file.job = &job;
+        file.in = in;
+        file.out = out;
+        file.in_direct = in_direct;
+        file.out_direct = out_direct;
+        if (fixed_files_) {
+            int fds[2] = {in, out};
+            fixed_files_ = file.fixed = io_uring_register_files_update(&ring_, 0, fds, 2) == 2;
+        }
+        opened(file);
+        run();
+
+        if (stats_.failed) throw std::system_error(first_error_, std::generic_category(), "copy " + source);
+        stats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats_;
+    }
+
+    // Copy every job; a file that fails is counted in `failed` (and described
+    // in `errors`) without stopping the others. Destination directories must
+    // exist, and `jobs` must not change until the call returns.
+    CopyStats copy_all(const std::vector<CopyJob>& jobs) {
+        auto start = std::chrono::steady_clock::now();
+        reset(&jobs);
+        for (std::size_t i = 0; i < jobs.size(); ++i) {
+            (jobs[i].size <= options_.small_file ? small_jobs_ : large_jobs_).push_back(i);
+        }
+        run();
+        stats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return stats_;
+    }
+
+private:
+    struct File {
+        const CopyJob* job = nullptr;
+        int in = -1;
+        int out = -1;
+        bool fixed = false; // in and out are registered files 0 and 1
+        bool large = false;
+        bool in_direct = false; // Opened (or being opened) with O_DIRECT
+        bool out_direct = false;
+        unsigned opening = 0; // Opens in flight
+        unsigned blocks = 0; // Blocks in flight
+        std::uint64_t next_offset = 0; // Start of the next block to hand out
+        int error = 0;
+    };
+
+    struct Slot {
+        unsigned file = 0;
+        std::uint64_t offset = 0; // File offset of the block
+        std::size_t length = 0;
+        std::size_t read = 0; // Bytes read so far
+        std::size_t written = 0; // Bytes written so far
+        unsigned pending = 0; // Operations in flight
+    };
+
+    // Low bits of user_data; the rest is a slot (reads, writes) or file (opens) index
+    enum Op : std::uint64_t { read_op, write_op, open_source_op, open_destination_op, close_op };
+    static constexpr unsigned op_bits = 3;
+
+    char* buffer(unsigned slot) const { return buffers_->buffer(slot); }
+
+    void reset(const std::vector<CopyJob>* jobs) {
+        stats_ = {};
+        first_error_ = 0;
+        jobs_ = jobs;
+        small_jobs_.clear();
+        large_jobs_.clear();
+        ready_small_.clear();
+        ready_large_.clear();
+        large_open_ = 0;
+        free_slots_.clear();
+        for (unsigned i = options_.depth; i-- > 0;) free_slots_.push_back(i);
+        free_files_.clear();
+        for (auto i = static_cast<unsigned>(files_.size()); i-- > 0;) free_files_.push_back(i);
+    }
+
+    unsigned take_file() {
+        unsigned index = free_files_.back();
+        free_files_.pop_back();
+        files_[index] = File{};
+        return index;
+    }
+
+    // Submit what is queued until `count` SQEs are free. Called before the
+    // first half of a link: the kernel ends a link chain at the end of a
+    // submission, so a submit between the halves would let the second run
+    // without waiting for the first.
+    void reserve_sqes(unsigned count) {
+        while (io_uring_sq_space_left(&ring_) < count) {
+            int ret = io_uring_submit(&ring_);
+            if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+                throw std::system_error(-ret, std::generic_category(), "io_uring_submit");
+            }
+        }
+    }
+
+    io_uring_sqe* next_sqe(std::uint64_t data) {
+        io_uring_sqe* sqe;
+        while (!(sqe = io_uring_get_sqe(&ring_))) io_uring_submit(&ring_);
+        io_uring_sqe_set_data64(sqe, data);
+        ++in_flight_;
+        return sqe;
+    }
+
+    // Submit, then handle completions until nothing is left to do
+    void run() {
+        for (;;) {
+            schedule();
+            if (in_flight_ == 0) break;
+            int ret = io_uring_submit_and_wait(&ring_, 1);
+            if (ret < 0 && ret != -EINTR) throw std::system_error(-ret, std::generic_category(), "io_uring_submit_and_wait");
+            unsigned head;
+            unsigned seen = 0;
+            io_uring_cqe* cqe;
+            io_uring_for_each_cqe(&ring_, head, cqe) {
+                complete(cqe);
+                ++seen;
+            }
+            io_uring_cq_advance(&ring_, seen);
+        }
+    }
+
+    // Open queued files while there is room (small ones first), then hand
+    // free buffers to open files (small ones first)
+    void schedule() {
+        while (!free_files_.empty()) {
+            bool large = small_jobs_.empty();
+            auto& queue = large ? large_jobs_ : small_jobs_;
+            if (queue.empty() || (large && large_open_ >= options_.large_files)) break;
+            std::size_t job = queue.front();
+            queue.pop_front();
+            start_open(job, large);
+        }
+        while (!free_slots_.empty()) {
+            auto& ready = !ready_small_.empty() ? ready_small_ : ready_large_;
+            if (ready.empty()) break;
+            const File& file = files_[ready.front()];
+            if (file.next_offset >= file.job->size) { // Failed
+                ready.pop_front();
+                continue;
+            }
+            unsigned slot = free_slots_.back();
+            free_slots_.pop_back();
+            start_block(slot, ready.front());
+            if (file.next_offset >= file.job->size) ready.pop_front();
+        }
+    }
+
+    void start_open(std::size_t job, bool large) {
+        unsigned index = take_file();
+        File& file = files_[index];
+        file.job = &(*jobs_)[job];
+        file.large = large;
+        file.in_direct = file.out_direct = options_.direct;
+        if (large) ++large_open_;
+        submit_opens(index);
+    }
+
+    // Open whichever of the file's descriptors are missing
+    void submit_opens(unsigned index) {
+        File& file = files_[index];
+        reserve_sqes((file.in < 0) + (file.out < 0));
+        if (file.in < 0) {
+            io_uring_sqe* sqe = next_sqe((std::uint64_t(index) << op_bits) | open_source_op);
+            io_uring_prep_openat(sqe, AT_FDCWD, file.job->source.c_str(), O_RDONLY | O_CLOEXEC | (file.in_direct ? O_DIRECT : 0), 0);
+            if (file.out < 0) io_uring_sqe_set_flags(sqe, IOSQE_IO_LINK);
+            ++file.opening;
+        }
+        if (file.out < 0) {
+            io_uring_sqe* sqe = next_sqe((std::uint64_t(index) << op_bits) | open_destination_op);
+            io_uring_prep_openat(sqe, AT_FDCWD, file.job->destination.c_str(),
+                                 O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | (file.out_direct ? O_DIRECT : 0), 0644);
+            ++file.opening;
+        }
+    }
+
+    // Both descriptors are known: queue the file for buffers, or finish it
+    void opened(File& file) {
+        auto index = static_cast<unsigned>(&file - files_.data());
+        if (file.error || file.job->size == 0) finish(index);
+        else (file.large ? ready_large_ : ready_small_).push_back(index);
+    }
+
+    // Close the descriptors (without waiting), count the file and free its entry
+    void finish(unsigned index) {
+        File& file = files_[index];
+        if (!file.error && file.out_direct && file.job->size % direct_alignment != 0) {
+            if (::ftruncate(file.out, static_cast<off_t>(file.job->size)) != 0) file.error = errno; // Drop the tail block's padding
+        }
+        if (options_.direct && (!file.in_direct || !file.out_direct)) ++stats_.buffered_fallbacks;
+        for (int fd : {file.in, file.out}) {
+            if (fd >= 0) io_uring_prep_close(next_sqe(close_op), fd);
+        }
+        if (file.error) {
+            for (auto* ready : {&ready_small_, &ready_large_}) { // A file that failed early may still be queued
+                ready->erase(std::remove(ready->begin(), ready->end(), index), ready->end());
+            }
+            ++stats_.failed;
+            if (!first_error_) first_error_ = file.error;
+            stats_.errors.push_back(file.job->source + ": " + std::strerror(file.error));
+        } else {
+            ++stats_.files;
+            stats_.bytes += file.job->size;
+        }
+        if (file.large) --large_open_;
+        free_files_.push_back(index);
+    }
+
+    // Queue a read of [from, length) of the slot's block
+    void prepare_read(unsigned slot, std::size_t from, bool link) {
+        Slot& s = slots_[slot];
+        const File& file = files_[s.file];
+        io_uring_sqe* sqe = next_sqe((std::uint64_t(slot) << op_bits) | read_op);
+        int fd = file.fixed ? 0 : file.in;
+        auto count = static_cast<unsigned>(file.in_direct ? align_up(s.length - from) : s.length - from);
+        if (fixed_buffers_) {
+            io_uring_prep_read_fixed(sqe, fd, buffer(slot) + from, count, s.offset + from, static_cast<int>(slot));
+        } else {
+            io_uring_prep_read(sqe, fd, buffer(slot) + from, count, s.offset + from);
+        }
+        io_uring_sqe_set_flags(sqe, (file.fixed ? IOSQE_FIXED_FILE : 0) | (link ? IOSQE_IO_LINK : 0));
+        ++s.pending;
+    }
+
+    // Queue a write of [from, length) of the slot's block
+    void prepare_write(unsigned slot, std::size_t from) {
+        Slot& s = slots_[slot];
+        const File& file = files_[s.file];
+        io_uring_sqe* sqe = next_sqe((std::uint64_t(slot) << op_bits) | write_op);
+        int fd = file.fixed ? 1 : file.out;
+        auto count = static_cast<unsigned>(file.out_direct ? align_up(s.length - from) : s.length - from);
+        if (fixed_buffers_) {
+            io_uring_prep_write_fixed(sqe, fd, buffer(slot) + from, count, s.offset + from, static_cast<int>(slot));
+        } else {
+            io_uring_prep_write(sqe, fd, buffer(slot) + from, count, s.offset + from);
+        }
+        io_uring_sqe_set_flags(sqe, file.fixed ? IOSQE_FIXED_FILE : 0);
+        ++s.pending;
+    }
+
+    // Queue a read of [from, length) of the slot's block, linked to a write of the whole block
+    void prepare_linked(unsigned slot, std::size_t from) {
+        reserve_sqes(2); // Both halves in the same submission
+        prepare_read(slot, from, true);
+        prepare_write(slot, 0);
+    }
+
+    // Give the slot the file's next block: read linked to write
+    void start_block(unsigned slot, unsigned index) {
+        File& file = files_[index];
+        Slot& s = slots_[slot];
+        s.file = index;
+        s.offset = file.next_offset;
+        s.length = static_cast<std::size_t>(std::min<std::uint64_t>(options_.block_size, file.job->size - file.next_offset));
+        s.read = s.written = 0;
+        file.next_offset += s.length;
+        ++file.blocks;
+        if (file.in_direct && s.length % direct_alignment != 0) {
+            prepare_read(slot, 0, false); // The tail: comes back short, which would cancel a linked write
+        } else {
+            prepare_linked(slot, 0);
+        }
+    }
+
+    void complete(io_uring_cqe* cqe) {
+        --in_flight_;
+        std::uint64_t data = io_uring_cqe_get_data64(cqe);
+        std::uint64_t op = data & ((1u << op_bits) - 1);
+        auto index = static_cast<unsigned>(data >> op_bits);
+        int res = cqe->res;
+        if (op == close_op) return;
+        if (op == open_source_op || op == open_destination_op) {
+            File& file = files_[index];
+            bool& direct = op == open_source_op ? file.in_direct : file.out_direct;
+            if (res >= 0) (op == open_source_op ? file.in : file.out) = res;
+            else if (res == -EINVAL && direct) direct = false; // No O_DIRECT here: reopened below
+            else if (res != -ECANCELED) fail(file, -res); // Cancelled: the source open failed, and decides
+            if (--file.opening > 0) return;
+            if (!file.error && (file.in < 0 || file.out < 0)) submit_opens(index);
+            else opened(file);
+            return;
+        }
+
+        Slot& s = slots_[index];
+        File& file = files_[s.file];
+        --s.pending;
+        if (op == read_op) {
+            if (res > 0) s.read += static_cast<std::size_t>(res);
+            else if (res == 0) fail(file, EIO); // The source shrank while being copied
+            else fail(file, -res);
+        } else if (res >= 0) {
+            s.written += static_cast<std::size_t>(res);
+        } else if (res != -ECANCELED) { // Cancelled: its read came up short, handled below
+            fail(file, -res);
+        }
+        if (s.pending > 0) return;
+
+        if (!file.error && s.read < s.length) {
+            ++stats_.short_reads;
+            s.written = 0; // Whatever the broken link wrote is rewritten in full
+            prepare_linked(index, s.read);
+        } else if (!file.error && s.written < s.length) {
+            if (s.written > 0) ++stats_.short_writes; // Otherwise the tail block, whose write was not linked
+            prepare_write(index, s.written);
+        } else {
+            free_slots_.push_back(index);
+            if (--file.blocks == 0 && file.next_offset >= file.job->size) finish(s.file);
+        }
+    }
+
+    // Remember the file's first error; its blocks in flight finish, no new ones start
+    void fail(File& file, int error) {
+        if (!file.error) file.error = error;
+        file.next_offset = file.job->size;
+    }
+
+    CopyOptions options_;
+    io_uring ring_;
+    std::optional<AlignedBufferPool> buffers_; // One block per slot
+    bool fixed_buffers_ = false;
+    bool fixed_files_ = false;
+    std::vector<Slot> slots_;
+    std::vector<File> files_;
+    std::vector<unsigned> free_slots_;
+    std::vector<unsigned> free_files_;
+    const std::vector<CopyJob>* jobs_ = nullptr;
+    std::deque<std::size_t> small_jobs_; // Not opened yet
+    std::deque<std::size_t> large_jobs_;
+    std::deque<unsigned> ready_small_; // Open, with blocks left to hand out
+    std::deque<unsigned> ready_large_;
+    unsigned large_open_ = 0;
+    unsigned in_flight_ = 0; // Submitted operations not yet completed
+    CopyStats stats_;
+    int first_error_ = 0;
+};